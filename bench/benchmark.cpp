@@ -0,0 +1,374 @@
+//times each stage of the solver on synthetic lenses and writes the results out as json, so runs on different commits can be compared
+//build it with the same flags as the viewer, for example
+//	g++ -std=c++20 -O3 -march=native -Isrc -I<eigen> bench/benchmark.cpp src/binning.cpp src/refract.cpp src/reorder.cpp src/irradiance.cpp src/lenscache.cpp src/mappedfile.cpp src/quantize.cpp src/statistics.cpp src/sweep.cpp src/threadpool.cpp -pthread -o benchmark
+//then run ./benchmark [--sizes 10000,1000000,50000000] [--stages parse,refract,...] [--out benchmark.json] [--label <commit>]
+//the 50M lens needs about 6GB in double precision, 3GB with CAUSTICS_SINGLE_PRECISION, and its .obj for the parse stage is about 4GB of text in the temp directory
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Eigen/Core"
+#include "binning.h"
+#include "irradiance.h"
+#include "raybuffer.h"
+#include "refract.h"
+#include "reorder.h"
+#include "simd.h"
+#include "sweep.h"
+#include "threadpool.h"
+
+struct BenchmarkResult {
+	std::string stage;
+	size_t vertices = 0;
+	int repetitions = 0;
+	double bestSeconds = 0;
+	double medianSeconds = 0;
+	double raysPerSecond = 0;	//from the best run, the median is there to show how noisy it was
+	double bytesPerSecond = 0;	//bytes each ray reads and writes in the arrays, not counting the histogram, so it's comparable to the machine's memory bandwidth
+};
+
+const double minSecondsPerStage = 0.5;	//keep repeating until this much time has gone by
+const int minRepetitions = 3;
+const int maxRepetitions = 50;
+
+template<typename F>
+static void Time(F&& run, BenchmarkResult* result) {	//best and median over repeated runs, the first one is a warm up that also faults the output pages in
+	run();
+	std::vector<double> seconds;
+	double total = 0;
+	while (int(seconds.size()) < maxRepetitions && (int(seconds.size()) < minRepetitions || total < minSecondsPerStage)) {
+		auto start = std::chrono::steady_clock::now();
+		run();
+		seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+		total += seconds.back();
+	}
+	std::sort(seconds.begin(), seconds.end());
+	result->repetitions = int(seconds.size());
+	result->bestSeconds = seconds.front();
+	result->medianSeconds = seconds[seconds.size() / 2];
+}
+
+static double Height(double x, double y) { return 0.05 * std::sin(3 * x) * std::cos(2 * y) + 0.02 * (x * x + y * y); }	//smooth bumps with a gentle bowl, so the caustic has both focused and spread out areas
+
+static void LensPoint(size_t i, size_t numVertices, Eigen::Vector3d* vertex, Eigen::Vector3d* normal) {	//the i'th vertex of a square-ish grid over (-1, 1), close to how the real lenses are laid out
+	size_t side = std::max<size_t>(2, size_t(std::ceil(std::sqrt(double(numVertices)))));
+	double x = -1 + 2 * double(i % side) / double(side - 1), y = -1 + 2 * double(i / side) / double(side - 1);
+	double dx = 0.15 * std::cos(3 * x) * std::cos(2 * y) + 0.04 * x;	//analytic gradient of Height
+	double dy = -0.1 * std::sin(3 * x) * std::sin(2 * y) + 0.04 * y;
+	*vertex = Eigen::Vector3d(x, y, Height(x, y));
+	*normal = Eigen::Vector3d(-dx, -dy, 1).normalized();
+}
+
+static void MakeLens(size_t numVertices, RayBuffer* vertices, RayBuffer* normals) {	//straight into the solver's buffers, a 50M vertex lens doesn't leave room for a Vector3d copy as well
+	vertices->resize(numVertices);
+	normals->resize(numVertices);
+	GlobalThreadPool().ParallelForRange(numVertices, size_t(1) << 16, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			Eigen::Vector3d vertex, normal;
+			LensPoint(i, numVertices, &vertex, &normal);
+			vertices->x[i] = Real(vertex.x()); vertices->y[i] = Real(vertex.y()); vertices->z[i] = Real(vertex.z());
+			normals->x[i] = Real(normal.x()); normals->y[i] = Real(normal.y()); normals->z[i] = Real(normal.z());
+		}
+	});
+}
+
+static void AppendVector(const char* prefix, const Eigen::Vector3d& v, std::string* text) {
+	char line[96];
+	char* p = line;
+	for (const char* c = prefix; *c != '\0'; c++) { *p++ = *c; }
+	for (int k = 0; k < 3; k++) {
+		*p++ = ' ';
+		p = std::to_chars(p, line + sizeof(line), v[k], std::chars_format::fixed, 9).ptr;
+	}
+	*p++ = '\n';
+	text->append(line, size_t(p - line));
+}
+
+static bool WriteLensOBJ(const std::string& path, size_t numVertices) {	//all the v lines, a vt line, then all the vn lines, the order exporters write them in, written a slab at a time so the text never all sits in memory
+	const size_t linesPerSlab = size_t(1) << 20;
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) { return false; }
+	for (int pass = 0; pass < 2; pass++) {
+		for (size_t slab = 0; slab < numVertices; slab += linesPerSlab) {
+			size_t slabEnd = std::min(numVertices, slab + linesPerSlab);
+			size_t numPieces = GlobalThreadPool().NumThreads();
+			std::vector<std::string> pieces(numPieces);
+			GlobalThreadPool().ParallelFor(numPieces, [&](size_t piece) {
+				size_t begin = slab + (slabEnd - slab) * piece / numPieces, end = slab + (slabEnd - slab) * (piece + 1) / numPieces;
+				for (size_t i = begin; i < end; i++) {
+					Eigen::Vector3d vertex, normal;
+					LensPoint(i, numVertices, &vertex, &normal);
+					AppendVector(pass == 0 ? "v" : "vn", pass == 0 ? vertex : normal, &pieces[piece]);
+				}
+			});
+			for (const std::string& piece : pieces) { file.write(piece.data(), std::streamsize(piece.size())); }
+		}
+		if (pass == 0) { file << "vt 0 0\n"; }	//every reader has to go past it to find the normals
+	}
+	return bool(file);
+}
+
+static void Record(const std::string& stage, size_t numVertices, double bytesPerRay, BenchmarkResult result, std::vector<BenchmarkResult>* results) {
+	result.stage = stage;
+	result.vertices = numVertices;
+	result.raysPerSecond = double(numVertices) / result.bestSeconds;
+	result.bytesPerSecond = bytesPerRay * double(numVertices) / result.bestSeconds;
+	std::cout << "  " << stage << ": " << result.bestSeconds * 1000 << " ms best, " << result.medianSeconds * 1000 << " ms median, "
+		<< result.raysPerSecond / 1e6 << " M rays/s, " << result.bytesPerSecond / 1e9 << " GB/s\n";
+	results->push_back(result);
+}
+
+static bool Wanted(const std::vector<std::string>& stages, const std::string& stage) { return stages.empty() || std::find(stages.begin(), stages.end(), stage) != stages.end(); }
+
+static std::vector<std::string> SplitList(const std::string& list) {
+	std::vector<std::string> items;
+	std::stringstream stream(list);
+	std::string item;
+	while (std::getline(stream, item, ',')) { if (!item.empty()) { items.push_back(item); } }
+	return items;
+}
+
+static bool BenchmarkLens(size_t numVertices, const std::vector<std::string>& stages, std::vector<BenchmarkResult>* results) {	//false if a consistency check along the way failed, the timings are still recorded
+	bool consistent = true;
+	const double eta = 1.457, d = 2;
+	const double S = double(sizeof(Real));
+	std::cout << numVertices << " vertices\n";
+
+	if (Wanted(stages, "parse") || Wanted(stages, "stream")) {	//the text parse on its own, WriteLensOBJ leaves no cache behind and ParseOBJ isn't asked to make one
+		std::string objPath = (std::filesystem::temp_directory_path() / ("caustics_benchmark_" + std::to_string(numVertices) + ".obj")).string();
+		if (WriteLensOBJ(objPath, numVertices)) {
+			double fileBytes = double(std::filesystem::file_size(objPath));
+			if (Wanted(stages, "parse")) {
+				std::vector<Eigen::Vector3d> parsedVertices, parsedNormals;
+				BenchmarkResult result;
+				Time([&] {
+					parsedVertices.clear();
+					parsedNormals.clear();
+					ParseOBJ(objPath, &parsedVertices, &parsedNormals);
+				}, &result);
+				Record("parse", numVertices, fileBytes / double(numVertices), result, results);
+			}
+			if (Wanted(stages, "stream")) {	//the whole --stream batch render from the text, parse to image, a block at a time
+				const double distance = d;
+				std::vector<Irradiance> images;
+				BenchmarkResult result;
+				Time([&] {
+					LensStream stream;
+					OpenLensStream(objPath, &stream);
+					StreamingSweep(&stream, size_t(1) << 20, eta, Light(), std::span<const double>(&distance, 1), 256, 256, &images);
+				}, &result);
+				Record("stream", numVertices, fileBytes / double(numVertices), result, results);
+
+				LensShardPlan textPlan, cachePlan;	//the text and the cache it leaves behind have to hand out the same rays, or a run would change with whether the .lensbin exists
+				std::vector<Eigen::Vector3d> cachedVertices, cachedNormals;
+				std::vector<Irradiance> cachedImages;
+				PlanLensShards(objPath, 3, &textPlan);
+				ParseOBJ(objPath, &cachedVertices, &cachedNormals, true);
+				cachedVertices = std::vector<Eigen::Vector3d>();	//only the cache it wrote is wanted
+				cachedNormals = std::vector<Eigen::Vector3d>();
+				LensStream stream;
+				if (OpenLensStream(objPath, &stream) && stream.fromCache && PlanLensShards(objPath, 3, &cachePlan)) {
+					StreamingSweep(&stream, size_t(1) << 20, eta, Light(), std::span<const double>(&distance, 1), 256, 256, &cachedImages);
+					bool samePlan = textPlan.shards.size() == cachePlan.shards.size();
+					for (size_t k = 0; samePlan && k < textPlan.shards.size(); k++) { samePlan = textPlan.shards[k].numRays == cachePlan.shards[k].numRays; }
+					if (cachedImages.size() != images.size() || cachedImages[0].pixels != images[0].pixels || !samePlan) {
+						std::cout << "  stream from the text and from its cache disagree\n";
+						consistent = false;
+					}
+				}
+				else { std::cout << "  couldn't cache " << objPath << ", skipping the text against cache check\n"; }
+			}
+		}
+		else { std::cout << "  couldn't write " << objPath << ", skipping parse and stream\n"; }
+		std::error_code error;
+		std::filesystem::remove(objPath, error);
+		std::filesystem::remove(LensCachePath(objPath), error);
+	}
+
+	if (Wanted(stages, "reorder")) {	//what --hilbert-order costs once, before it's cached, the faces are left out since the synthetic lens has none
+		std::vector<Eigen::Vector3d> lensVertices(numVertices), lensNormals(numVertices), sortedVertices, sortedNormals;
+		for (size_t i = 0; i < numVertices; i++) { LensPoint(i, numVertices, &lensVertices[i], &lensNormals[i]); }
+		std::vector<Triangle> noTriangles;
+		BenchmarkResult result;
+		Time([&] {
+			sortedVertices = lensVertices;
+			sortedNormals = lensNormals;
+			ReorderAlongHilbertCurve(&sortedVertices, &sortedNormals, &noTriangles);
+		}, &result);
+		Record("reorder", numVertices, 6 * 8, result, results);
+	}
+
+	RayBuffer vertices, normals, refracteds;
+	MakeLens(numVertices, &vertices, &normals);
+	AffineIntersections affine;
+	PointBuffer intersections;
+	BenchmarkResult result;
+
+	if (Wanted(stages, "refract")) {
+		Time([&] { Refract(normals, &refracteds, eta); }, &result);
+		Record("refract", numVertices, 6 * S, result, results);	//normal in, direction out
+	}
+	if (Wanted(stages, "refract_point_light")) {
+		Light light;
+		light.type = Light::Type::Point;
+		light.position = Eigen::Vector3d(0.1, 0.2, -2);
+		Time([&] { Refract(vertices, normals, &refracteds, eta, light); }, &result);
+		Record("refract_point_light", numVertices, 12 * S, result, results);	//vertex and normal in, direction out
+	}
+	if (Wanted(stages, "intersect")) {	//the original two pass path
+		Refract(normals, &refracteds, eta);
+		Time([&] { CalculateIntersections(vertices, refracteds, &intersections, d); }, &result);
+		Record("intersect", numVertices, 8 * S, result, results);
+	}
+	if (Wanted(stages, "refract_and_intersect")) {
+		Time([&] { RefractAndIntersect(vertices, normals, &intersections, eta, d); }, &result);
+		Record("refract_and_intersect", numVertices, 8 * S, result, results);
+	}
+	if (Wanted(stages, "prepare_affine")) {
+		Refract(normals, &refracteds, eta);
+		Time([&] { PrepareAffineIntersections(vertices, refracteds, &affine); }, &result);
+		Record("prepare_affine", numVertices, 10 * S, result, results);
+	}
+	if (Wanted(stages, "prepare_quantized")) {	//refract and prepare_affine in one pass from the 10 byte rays of --quantize
+		QuantizedLens quantized;
+		{
+			std::vector<Eigen::Vector3d> lensVertices(numVertices), lensNormals(numVertices);
+			for (size_t i = 0; i < numVertices; i++) { LensPoint(i, numVertices, &lensVertices[i], &lensNormals[i]); }
+			QuantizeLens(lensVertices, lensNormals, &quantized);
+		}
+		Time([&] { PrepareQuantizedIntersections(quantized, eta, Light(), &affine); }, &result);
+		Record("prepare_quantized", numVertices, 10 + 4 * S, result, results);
+	}
+	refracteds = RayBuffer();	//the rest only needs the affine form
+	if (affine.size() != numVertices) {
+		RayBuffer directions;
+		Refract(normals, &directions, eta);
+		PrepareAffineIntersections(vertices, directions, &affine);
+	}
+	if (Wanted(stages, "intersect_affine")) {	//what the viewer does every time the plane moves
+		Time([&] { CalculateIntersections(affine, &intersections, d); }, &result);
+		Record("intersect_affine", numVertices, 6 * S, result, results);
+	}
+	if (Wanted(stages, "accumulate")) {
+		Irradiance irradiance;
+		irradiance.Resize(256, 256);
+		CalculateIntersections(affine, &intersections, d);
+		Time([&] { AccumulateIrradiance(intersections, &irradiance); }, &result);
+		Record("accumulate", numVertices, 2 * S, result, results);
+	}
+	if (Wanted(stages, "frame")) {	//the cpu side of DrawIntersections at the default window size, everything but the texture upload, so this is the viewer's time per frame when the plane moves
+		Irradiance irradiance;
+		irradiance.Resize(256, 256);
+		std::vector<uint32_t> argb(256 * 256);
+		Time([&] {
+			CalculateIntersections(affine, &intersections, d);
+			AccumulateIrradiance(intersections, &irradiance);
+			ToneMap(irradiance, argb.data(), 256);
+		}, &result);
+		Record("frame", numVertices, 8 * S, result, results);
+		std::cout << "  frame: " << 1 / result.bestSeconds << " fps best, " << 1 / result.medianSeconds << " fps median\n";
+	}
+	AffineIntersections active;
+	if (Wanted(stages, "compact")) {	//what the viewer pays once per index, and again when the plane leaves the window
+		Time([&] { CompactIntersections(affine, d - 1, d + 1, &active); }, &result);
+		Record("compact", numVertices, 4 * S, result, results);
+		std::cout << "  compact: " << active.size() << " of " << numVertices << " rays can land on screen\n";
+	}
+	if (Wanted(stages, "frame_active")) {	//the same frame over just the rays that survived compaction, rays per second still counts the whole lens
+		Irradiance irradiance;
+		irradiance.Resize(256, 256);
+		std::vector<uint32_t> argb(256 * 256);
+		CompactIntersections(affine, d - 1, d + 1, &active);
+		Time([&] {
+			CalculateIntersections(active, &intersections, d);
+			AccumulateIrradiance(intersections, &irradiance);
+			ToneMap(irradiance, argb.data(), 256);
+		}, &result);
+		Record("frame_active", numVertices, 8 * S * double(active.size()) / double(std::max<size_t>(numVertices, 1)), result, results);
+	}
+	const int largeSize = 2048;	//big enough that a histogram per thread no longer fits in cache
+	if (Wanted(stages, "accumulate_large")) {	//intersect and splat in mesh order, to compare with the binned version
+		Irradiance irradiance;
+		irradiance.Resize(largeSize, largeSize);
+		Time([&] {
+			CalculateIntersections(affine, &intersections, d);
+			AccumulateIrradiance(intersections, &irradiance);
+		}, &result);
+		Record("accumulate_large", numVertices, 6 * S, result, results);
+	}
+	if (Wanted(stages, "accumulate_binned")) {	//binned a little way off so the reused order has some drift in it, like the viewer after a few presses of W
+		TileBins bins;
+		Irradiance irradiance;
+		BinIntersections(affine, d - 0.05, largeSize, largeSize, &bins);
+		Time([&] { AccumulateBinned(&bins, d, &irradiance); }, &result);
+		Record("accumulate_binned", numVertices, 4 * S, result, results);
+		std::cout << "  accumulate_binned: " << bins.spilled << " rays left their tile\n";
+		Time([&] { BinIntersections(affine, d, largeSize, largeSize, &bins); }, &result);
+		Record("bin", numVertices, 8 * S, result, results);
+	}
+	return consistent;
+}
+
+static std::string JSONString(const std::string& text) {
+	std::string quoted = "\"";
+	for (char c : text) {
+		if (c == '"' || c == '\\') { quoted += '\\'; }
+		if (c >= 0 && c < 0x20) { continue; }	//no control characters in stage names or labels anyway
+		quoted += c;
+	}
+	return quoted + "\"";
+}
+
+static bool WriteResults(const std::string& path, const std::string& label, const std::vector<BenchmarkResult>& results) {	//one object per run, with enough about the build and the machine to know whether two runs are comparable
+	std::ofstream file(path, std::ios::trunc);
+	if (!file.is_open()) { return false; }
+	file.precision(9);
+	file << "{\n";
+	file << "\t\"label\": " << JSONString(label) << ",\n";
+	file << "\t\"precision\": " << JSONString(sizeof(Real) == 4 ? "single" : "double") << ",\n";
+	file << "\t\"vector_width\": " << Batch<Real>::width << ",\n";
+	file << "\t\"threads\": " << GlobalThreadPool().NumThreads() << ",\n";
+	file << "\t\"results\": [\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		const BenchmarkResult& r = results[i];
+		file << "\t\t{ \"stage\": " << JSONString(r.stage) << ", \"vertices\": " << r.vertices << ", \"repetitions\": " << r.repetitions
+			<< ", \"best_seconds\": " << r.bestSeconds << ", \"median_seconds\": " << r.medianSeconds
+			<< ", \"rays_per_second\": " << r.raysPerSecond << ", \"bytes_per_second\": " << r.bytesPerSecond << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	file << "\t]\n}\n";
+	return bool(file);
+}
+
+int main(int argc, char** argv) {
+	std::vector<size_t> sizes = { 10000, 1000000, 50000000 };
+	std::vector<std::string> stages;	//empty runs them all: parse, refract, refract_point_light, intersect, refract_and_intersect, prepare_affine, intersect_affine, accumulate, frame, compact, frame_active, accumulate_large, accumulate_binned, reorder, stream
+	std::string outputPath = "benchmark.json";
+	std::string label;					//free text stored with the results, the commit hash is the useful thing to put here
+	for (int i = 1; i < argc; i++) {
+		if (std::string(argv[i]) == "--sizes" && i + 1 < argc) {
+			sizes.clear();
+			for (const std::string& size : SplitList(argv[++i])) { sizes.push_back(size_t(std::stoull(size))); }
+		}
+		else if (std::string(argv[i]) == "--stages" && i + 1 < argc) { stages = SplitList(argv[++i]); }
+		else if (std::string(argv[i]) == "--out" && i + 1 < argc) { outputPath = argv[++i]; }
+		else if (std::string(argv[i]) == "--label" && i + 1 < argc) { label = argv[++i]; }
+		else { std::cout << "Unknown option " << argv[i] << "\n"; }
+	}
+
+	std::cout << (sizeof(Real) == 4 ? "single" : "double") << " precision, " << Batch<Real>::width << " rays per vector, " << GlobalThreadPool().NumThreads() << " threads\n";
+	std::vector<BenchmarkResult> results;
+	bool consistent = true;
+	for (size_t numVertices : sizes) { consistent = BenchmarkLens(numVertices, stages, &results) && consistent; }
+	if (!WriteResults(outputPath, label, results)) { std::cout << "Couldn't write " << outputPath << "\n"; return 1; }
+	std::cout << "Wrote " << outputPath << "\n";
+	return consistent ? 0 : 1;
+}
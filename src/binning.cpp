@@ -0,0 +1,148 @@
+#include "binning.h"
+
+#include <algorithm>
+
+#include "statistics.h"
+#include "threadpool.h"
+
+const size_t raysPerBinChunk = size_t(1) << 16;	//rays per counting task
+const size_t raysPerPiece = size_t(1) << 16;	//at most this many rays per accumulating task, so a tile the caustic piles into still gets shared out over the threads
+
+template<typename Scalar>
+struct ImageMapping {	//where a ray lands in the image at one distance, the same arithmetic as the sweep
+	Scalar d, scaleX, scaleY, width, height;
+
+	ImageMapping(double d, int width, int height) : d(Scalar(d)), scaleX(Scalar(width) / 256), scaleY(Scalar(height) / 256), width(Scalar(width)), height(Scalar(height)) {}
+
+	bool operator()(const BasicAffineIntersections<Scalar>& rays, size_t i, size_t* px, size_t* py) const {	//false if it misses
+		Scalar x = (rays.offset.x[i] + d * rays.slope.x[i]) * scaleX;
+		Scalar y = (rays.offset.y[i] + d * rays.slope.y[i]) * scaleY;
+		if (!(x >= 0 && x < width && y >= 0 && y < height)) { return false; }
+		*px = size_t(x);
+		*py = size_t(y);
+		return true;
+	}
+};
+
+template<typename Scalar>
+void BinIntersections(const BasicAffineIntersections<Scalar>& affine, double d, int width, int height, BasicTileBins<Scalar>* bins) {
+	ScopedTimer timer(Stage::Accumulate);
+	bins->width = width;
+	bins->height = height;
+	bins->tilesX = (width + tileSize - 1) / tileSize;
+	bins->tilesY = (height + tileSize - 1) / tileSize;
+	bins->plane = d;
+	bins->spilled = 0;
+	size_t numTiles = size_t(bins->tilesX) * size_t(bins->tilesY), numBins = numTiles + 1;
+	size_t numRays = affine.size();
+	size_t numChunks = (numRays + raysPerBinChunk - 1) / raysPerBinChunk;
+	const ImageMapping<Scalar> mapping(d, width, height);
+
+	bins->binOf.resize(numRays);
+	bins->counts.assign(numChunks * numBins, 0);
+	ThreadPool& pool = GlobalThreadPool();
+	pool.ParallelForRange(numRays, raysPerBinChunk, [&](size_t begin, size_t end) {	//count each chunk's rays per tile
+		size_t* counts = bins->counts.data() + begin / raysPerBinChunk * numBins;
+		for (size_t i = begin; i < end; i++) {
+			size_t px, py;
+			uint32_t bin = mapping(affine, i, &px, &py) ? uint32_t(py / tileSize * size_t(bins->tilesX) + px / tileSize) : uint32_t(numTiles);
+			bins->binOf[i] = bin;
+			counts[bin]++;
+		}
+	});
+
+	bins->tileStarts.resize(numBins + 1);
+	size_t start = 0;
+	for (size_t bin = 0; bin < numBins; bin++) {	//the counts become where each chunk's share of each tile starts, tile major so a tile's rays end up together and still in mesh order
+		bins->tileStarts[bin] = start;
+		for (size_t chunk = 0; chunk < numChunks; chunk++) {
+			size_t& count = bins->counts[chunk * numBins + bin];
+			size_t next = start + count;
+			count = start;
+			start = next;
+		}
+	}
+	bins->tileStarts[numBins] = start;
+
+	bins->rays.resize(numRays);
+	pool.ParallelForRange(numRays, raysPerBinChunk, [&](size_t begin, size_t end) {	//every chunk scatters into slices nobody else writes
+		size_t* cursors = bins->counts.data() + begin / raysPerBinChunk * numBins;
+		for (size_t i = begin; i < end; i++) {
+			size_t j = cursors[bins->binOf[i]]++;
+			bins->rays.offset.x[j] = affine.offset.x[i];
+			bins->rays.offset.y[j] = affine.offset.y[i];
+			bins->rays.slope.x[j] = affine.slope.x[i];
+			bins->rays.slope.y[j] = affine.slope.y[i];
+		}
+	});
+}
+
+struct BinPiece {	//a run of one bin's rays for one task
+	size_t bin, begin, end;
+};
+
+template<typename Scalar>
+void AccumulateBinned(BasicTileBins<Scalar>* bins, double d, Irradiance* irradiance) {
+	ScopedTimer timer(Stage::Accumulate);
+	if (irradiance->width != bins->width || irradiance->height != bins->height) { irradiance->Resize(bins->width, bins->height); }
+	if (bins->tileStarts.empty()) { return; }	//never binned
+	size_t numTiles = size_t(bins->tilesX) * size_t(bins->tilesY);
+	size_t width = size_t(bins->width), height = size_t(bins->height);
+	const size_t tileArea = size_t(tileSize) * size_t(tileSize);
+	const ImageMapping<Scalar> mapping(d, bins->width, bins->height);
+
+	std::vector<BinPiece> pieces;
+	std::vector<size_t> firstPiece(numTiles + 2);	//tile t's pieces are [firstPiece[t], firstPiece[t + 1]), the missed bin's come last
+	for (size_t bin = 0; bin <= numTiles; bin++) {
+		firstPiece[bin] = pieces.size();
+		for (size_t begin = bins->tileStarts[bin]; begin < bins->tileStarts[bin + 1]; begin += raysPerPiece) { pieces.push_back({ bin, begin, std::min(begin + raysPerPiece, bins->tileStarts[bin + 1]) }); }
+	}
+	firstPiece[numTiles + 1] = pieces.size();
+
+	bins->blocks.resize(firstPiece[numTiles] * tileArea);	//the missed bin's pieces don't get a block, anything of theirs that lands now is a spill
+	bins->spills.resize(pieces.size());
+	ThreadPool& pool = GlobalThreadPool();
+	pool.ParallelFor(pieces.size(), [&](size_t p) {
+		const BinPiece& piece = pieces[p];
+		std::vector<uint32_t>& spills = bins->spills[p];
+		spills.clear();
+		bool hasBlock = piece.bin < numTiles;
+		float* block = hasBlock ? bins->blocks.data() + p * tileArea : nullptr;
+		if (hasBlock) { std::fill(block, block + tileArea, 0.0f); }
+		size_t tileX = hasBlock ? piece.bin % size_t(bins->tilesX) * tileSize : 0, tileY = hasBlock ? piece.bin / size_t(bins->tilesX) * tileSize : 0;
+		size_t offScreen = 0;
+		for (size_t i = piece.begin; i < piece.end; i++) {
+			size_t px, py;
+			if (!mapping(bins->rays, i, &px, &py)) { offScreen++; continue; }
+			if (hasBlock && px - tileX < size_t(tileSize) && py - tileY < size_t(tileSize)) { block[(py - tileY) * tileSize + (px - tileX)] += 1.0f; }	//unsigned, so left of or above the tile wraps around and fails too
+			else { spills.push_back(uint32_t(py * width + px)); }
+		}
+		CountSplatted(piece.end - piece.begin, offScreen);
+	});
+
+	float* pixels = irradiance->pixels.data();
+	pool.ParallelFor(numTiles, [&](size_t tile) {	//a tile only adds up its own pieces, so the tiles write the image without getting in each other's way
+		size_t x0 = tile % size_t(bins->tilesX) * tileSize, y0 = tile / size_t(bins->tilesX) * tileSize;
+		size_t tileWidth = std::min<size_t>(tileSize, width - x0), tileHeight = std::min<size_t>(tileSize, height - y0);
+		for (size_t row = 0; row < tileHeight; row++) {
+			float* out = pixels + (y0 + row) * width + x0;
+			std::fill(out, out + tileWidth, 0.0f);
+			for (size_t p = firstPiece[tile]; p < firstPiece[tile + 1]; p++) {
+				const float* in = bins->blocks.data() + p * tileArea + row * tileSize;
+				for (size_t x = 0; x < tileWidth; x++) { out[x] += in[x]; }
+			}
+		}
+	});
+
+	size_t spilled = 0;
+	for (const std::vector<uint32_t>& spills : bins->spills) {	//one thread is plenty, there are only a few unless the order has gone stale, and then the caller rebins
+		for (uint32_t pixel : spills) { pixels[pixel] += 1.0f; }
+		spilled += spills.size();
+	}
+	bins->spilled = spilled;
+}
+
+template void BinIntersections(const BasicAffineIntersections<float>&, double, int, int, BasicTileBins<float>*);
+template void BinIntersections(const BasicAffineIntersections<double>&, double, int, int, BasicTileBins<double>*);
+template void AccumulateBinned(BasicTileBins<float>*, double, Irradiance*);
+template void AccumulateBinned(BasicTileBins<double>*, double, Irradiance*);
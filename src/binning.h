@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "irradiance.h"
+#include "raybuffer.h"
+
+//splatting in screen tile order instead of mesh order, for images too big for the per task histograms to stay in cache
+//the rays get counting sorted by the tile they hit at one distance and each tile is then accumulated in a block that fits in L1
+//the order only depends on where the rays go, so it stays good for nearby distances, the few rays that drift into another tile by then are added on their own
+
+const int tileSize = 64;	//64x64 floats is 16KB
+
+template<typename Scalar>
+struct BasicTileBins {
+	BasicAffineIntersections<Scalar> rays;	//a copy of the binned rays in tile order
+	std::vector<size_t> tileStarts;			//tile t's rays are [tileStarts[t], tileStarts[t + 1]), tiles go row by row and the bin after the last tile holds the rays that missed the image
+	int width = 0, height = 0;				//the irradiance size the tiles were cut for
+	int tilesX = 0, tilesY = 0;
+	double plane = 0;						//the receiver distance the rays were binned at
+	size_t spilled = 0;						//how many rays landed outside their own tile last time, the sign that the order has gone stale
+
+	std::vector<uint32_t> binOf;			//scratch for binning, kept between calls so they're only allocated once
+	std::vector<size_t> counts;
+	std::vector<float> blocks;				//scratch for accumulating, one tile sized block per piece of work
+	std::vector<std::vector<uint32_t>> spills;
+
+	bool NeedsRebinning(int newWidth, int newHeight) const { return newWidth != width || newHeight != height || spilled > rays.size() / 8; }
+};
+
+using TileBins = BasicTileBins<Real>;
+
+template<typename Scalar>
+void BinIntersections(const BasicAffineIntersections<Scalar>& affine, double d, int width, int height, BasicTileBins<Scalar>* bins);	//sorts the rays by the tile of a width x height image they hit at distance d
+
+template<typename Scalar>
+void AccumulateBinned(BasicTileBins<Scalar>* bins, double d, Irradiance* irradiance);	//the same image CalculateIntersections then AccumulateIrradiance would make at distance d, irradiance gets resized to the size the bins were cut for
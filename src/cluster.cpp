@@ -0,0 +1,320 @@
+#include "cluster.h"
+
+#include <iostream>
+
+#ifdef _WIN32
+
+bool DistributedSweep(const ClusterJob&, std::vector<Irradiance>*) { std::cout << "Distributed sweeps need POSIX sockets, this build doesn't have them\n"; return false; }
+
+bool ServeSweeps(const std::string&, int) { std::cout << "Distributed sweeps need POSIX sockets, this build doesn't have them\n"; return false; }
+
+#else
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "statistics.h"
+#include "sweep.h"
+
+static const char jobMagic[8] = { 'C', 'S', 'J', 'O', 'B', '0', '0', '1' };
+static const char resultMagic[8] = { 'C', 'S', 'R', 'E', 'S', '0', '0', '1' };
+const uint64_t maxJobBytes = uint64_t(1) << 26;	//a job is a few KB even with thousands of nodes, anything bigger isn't one of ours
+const int jobTimeoutSeconds = 10;					//how long a new connection has to send its job
+#ifdef MSG_NOSIGNAL
+const int sendFlags = MSG_NOSIGNAL;	//a parent that went away should fail the send, not kill the worker with SIGPIPE
+#else
+const int sendFlags = 0;
+#endif
+
+struct Socket {	//closes the descriptor when it goes out of scope, -1 for none
+	int fd = -1;
+
+	Socket() = default;
+	explicit Socket(int fd) : fd(fd) {}
+	Socket(const Socket&) = delete;
+	Socket& operator=(const Socket&) = delete;
+	~Socket() { if (fd >= 0) { close(fd); } }
+};
+
+static bool SendAll(int socket, const void* data, size_t size) {
+	const char* p = static_cast<const char*>(data);
+	while (size > 0) {
+		ssize_t sent = send(socket, p, size, sendFlags);
+		if (sent < 0 && errno == EINTR) { continue; }
+		if (sent <= 0) { return false; }
+		p += sent;
+		size -= size_t(sent);
+	}
+	return true;
+}
+
+static bool ReceiveAll(int socket, void* data, size_t size) {	//false if the other end closes first
+	char* p = static_cast<char*>(data);
+	while (size > 0) {
+		ssize_t received = recv(socket, p, size, 0);
+		if (received < 0 && errno == EINTR) { continue; }
+		if (received <= 0) { return false; }
+		p += received;
+		size -= size_t(received);
+	}
+	return true;
+}
+
+static bool SetTimeout(int socket, int seconds) {	//sends and receives that make no progress for this long fail instead of blocking forever
+	timeval timeout = {};
+	timeout.tv_sec = seconds;
+	return setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0 && setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == 0;
+}
+
+static int Connect(const std::string& address, int timeoutSeconds) {	//host:port, -1 if it can't be reached, the timeout covers the connect too
+	size_t colon = address.rfind(':');
+	if (colon == std::string::npos) { return -1; }
+	std::string host = address.substr(0, colon), port = address.substr(colon + 1);
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* found = nullptr;
+	if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0) { return -1; }
+	int connection = -1;
+	for (addrinfo* candidate = found; candidate != nullptr && connection < 0; candidate = candidate->ai_next) {
+		connection = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+		if (connection >= 0 && (!SetTimeout(connection, timeoutSeconds) || connect(connection, candidate->ai_addr, candidate->ai_addrlen) != 0)) {
+			close(connection);
+			connection = -1;
+		}
+	}
+	freeaddrinfo(found);
+	return connection;
+}
+
+//jobs go over as one length prefixed message of fields in a fixed order, results as a header followed by the raw histograms
+
+template<typename T>
+static void Put(std::string* message, const T& value) {
+	static_assert(std::is_trivially_copyable_v<T>, "only plain values go over the wire as they are");
+	message->append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+static void PutString(std::string* message, const std::string& value) {
+	Put(message, uint64_t(value.size()));
+	message->append(value);
+}
+
+struct MessageReader {	//takes fields back out in the order they were put in, ok goes false for good at the first one that runs past the end
+	const char* p;
+	const char* end;
+	bool ok = true;
+
+	size_t Left() const { return size_t(end - p); }
+};
+
+template<typename T>
+static T Get(MessageReader* reader) {
+	T value{};
+	if (!reader->ok || reader->Left() < sizeof(T)) { reader->ok = false; return value; }
+	memcpy(&value, reader->p, sizeof(T));
+	reader->p += sizeof(T);
+	return value;
+}
+
+static std::string GetString(MessageReader* reader) {
+	uint64_t size = Get<uint64_t>(reader);
+	if (!reader->ok || size > reader->Left()) { reader->ok = false; return std::string(); }
+	std::string value(reader->p, size_t(size));
+	reader->p += size;
+	return value;
+}
+
+static std::string EncodeJob(const ClusterJob& job, size_t node) {
+	std::string message(jobMagic, sizeof(jobMagic));
+	Put(&message, uint64_t(node));
+	PutString(&message, job.lensPath);
+	Put(&message, uint8_t(job.plan.fromCache));
+	Put(&message, job.plan.sourceSize);
+	Put(&message, job.plan.sourceHash);
+	Put(&message, uint64_t(job.plan.shards.size()));
+	for (const LensShard& shard : job.plan.shards) { Put(&message, shard); }
+	Put(&message, uint64_t(job.workers.size()));
+	for (const std::string& worker : job.workers) { PutString(&message, worker); }
+	Put(&message, uint64_t(job.raysPerBlock));
+	Put(&message, job.eta);
+	Put(&message, int32_t(job.light.type));
+	for (int c = 0; c < 3; c++) { Put(&message, job.light.direction[c]); }
+	for (int c = 0; c < 3; c++) { Put(&message, job.light.position[c]); }
+	Put(&message, uint64_t(job.distances.size()));
+	for (double distance : job.distances) { Put(&message, distance); }
+	Put(&message, int32_t(job.width));
+	Put(&message, int32_t(job.height));
+	Put(&message, int32_t(job.timeoutSeconds));
+	return message;
+}
+
+static bool JobFits(const ClusterJob& job) {	//images small enough to allocate on every node, checked without multiplying anything that could wrap
+	if (job.width <= 0 || job.height <= 0) { return false; }
+	uint64_t numPixels = uint64_t(job.width) * uint64_t(job.height);	//two positive int32's can't overflow this
+	return numPixels <= maxClusterHistogramFloats && job.distances.size() <= maxClusterHistogramFloats / numPixels;
+}
+
+static bool DecodeJob(const std::string& message, ClusterJob* job, size_t* node) {
+	if (message.size() < sizeof(jobMagic) || memcmp(message.data(), jobMagic, sizeof(jobMagic)) != 0) { return false; }
+	MessageReader reader{ message.data() + sizeof(jobMagic), message.data() + message.size() };
+	*node = size_t(Get<uint64_t>(&reader));
+	job->lensPath = GetString(&reader);
+	job->plan.fromCache = Get<uint8_t>(&reader) != 0;
+	job->plan.sourceSize = Get<uint64_t>(&reader);
+	job->plan.sourceHash = Get<uint64_t>(&reader);
+	uint64_t numShards = Get<uint64_t>(&reader);
+	if (!reader.ok || numShards > reader.Left() / sizeof(LensShard)) { return false; }	//checked before sizing anything off it
+	job->plan.shards.resize(size_t(numShards));
+	for (LensShard& shard : job->plan.shards) { shard = Get<LensShard>(&reader); }
+	uint64_t numWorkers = Get<uint64_t>(&reader);
+	if (!reader.ok || numWorkers > reader.Left() / sizeof(uint64_t)) { return false; }
+	job->workers.resize(size_t(numWorkers));
+	for (std::string& worker : job->workers) { worker = GetString(&reader); }
+	job->raysPerBlock = size_t(Get<uint64_t>(&reader));
+	job->eta = Get<double>(&reader);
+	int32_t lightType = Get<int32_t>(&reader);
+	job->light.type = Light::Type(lightType);
+	for (int c = 0; c < 3; c++) { job->light.direction[c] = Get<double>(&reader); }
+	for (int c = 0; c < 3; c++) { job->light.position[c] = Get<double>(&reader); }
+	uint64_t numDistances = Get<uint64_t>(&reader);
+	if (!reader.ok || numDistances > reader.Left() / sizeof(double)) { return false; }
+	job->distances.resize(size_t(numDistances));
+	for (double& distance : job->distances) { distance = Get<double>(&reader); }
+	job->width = Get<int32_t>(&reader);
+	job->height = Get<int32_t>(&reader);
+	job->timeoutSeconds = Get<int32_t>(&reader);
+	return reader.ok && reader.Left() == 0 && lightType >= 0 && lightType <= int32_t(Light::Type::Point) && job->plan.shards.size() == job->workers.size() + 1 &&
+		*node < job->plan.shards.size() && job->raysPerBlock > 0 && job->timeoutSeconds > 0 && JobFits(*job);
+}
+
+static bool SendJob(int socket, const ClusterJob& job, size_t node) {
+	std::string message = EncodeJob(job, node);
+	uint64_t size = message.size();
+	return SendAll(socket, &size, sizeof(size)) && SendAll(socket, message.data(), message.size());
+}
+
+static bool ReceiveJob(int socket, ClusterJob* job, size_t* node) {
+	uint64_t size = 0;
+	if (!ReceiveAll(socket, &size, sizeof(size)) || size > maxJobBytes) { return false; }
+	std::string message(size_t(size), '\0');
+	return ReceiveAll(socket, message.data(), message.size()) && DecodeJob(message, job, node);
+}
+
+static bool SendResult(int socket, bool ok, const std::string& error, const std::vector<Irradiance>& images) {	//the histograms go straight from the images, they're the one big thing here
+	std::string header(resultMagic, sizeof(resultMagic));
+	Put(&header, uint8_t(ok));
+	PutString(&header, error);
+	if (ok) {
+		Put(&header, uint64_t(images.size()));
+		Put(&header, int32_t(images.empty() ? 0 : images[0].width));
+		Put(&header, int32_t(images.empty() ? 0 : images[0].height));
+	}
+	if (!SendAll(socket, header.data(), header.size())) { return false; }
+	if (!ok) { return true; }
+	for (const Irradiance& image : images) {
+		if (!SendAll(socket, image.pixels.data(), image.pixels.size() * sizeof(float))) { return false; }
+	}
+	return true;
+}
+
+static bool ReceiveResult(int socket, size_t child, const ClusterJob& job, std::vector<Irradiance>* images, std::string* error) {	//adds a subtree's histograms into images
+	ScopedTimer timer(Stage::Reduce);
+	std::string lost = "lost the connection to node " + std::to_string(child) + ", or it went quiet for longer than the timeout";
+	char magic[sizeof(resultMagic)];
+	uint8_t ok = 0;
+	uint64_t errorSize = 0;
+	if (!ReceiveAll(socket, magic, sizeof(magic)) || memcmp(magic, resultMagic, sizeof(magic)) != 0 || !ReceiveAll(socket, &ok, sizeof(ok)) ||
+		!ReceiveAll(socket, &errorSize, sizeof(errorSize)) || errorSize > maxJobBytes) { *error = lost; return false; }
+	std::string message(size_t(errorSize), '\0');
+	if (!ReceiveAll(socket, message.data(), message.size())) { *error = lost; return false; }
+	if (!ok) { *error = message; return false; }	//already says which node it came from
+
+	uint64_t numImages = 0;
+	int32_t width = 0, height = 0;
+	if (!ReceiveAll(socket, &numImages, sizeof(numImages)) || !ReceiveAll(socket, &width, sizeof(width)) || !ReceiveAll(socket, &height, sizeof(height))) { *error = lost; return false; }
+	if (numImages != images->size() || width != job.width || height != job.height) { *error = "node " + std::to_string(child) + " sent back histograms of the wrong size"; return false; }
+	std::vector<float> partial(size_t(width) * size_t(height));
+	for (Irradiance& image : *images) {
+		if (!ReceiveAll(socket, partial.data(), partial.size() * sizeof(float))) { *error = lost; return false; }
+		for (size_t i = 0; i < partial.size(); i++) { image.pixels[i] += partial[i]; }
+	}
+	return true;
+}
+
+static bool RunNode(const ClusterJob& job, size_t node, std::vector<Irradiance>* images, std::string* error) {	//this node's shard plus everything below it in the tree
+	size_t numNodes = job.plan.shards.size();
+	const size_t children[2] = { 2 * node + 1, 2 * node + 2 };
+	Socket connections[2];
+	for (int c = 0; c < 2; c++) {	//the subtrees get going before this node starts on its own shard
+		if (children[c] >= numNodes) { continue; }
+		const std::string& address = job.workers[children[c] - 1];
+		connections[c].fd = Connect(address, job.timeoutSeconds);
+		if (connections[c].fd < 0 || !SendJob(connections[c].fd, job, children[c])) { *error = "couldn't send the job to node " + std::to_string(children[c]) + " at " + address; return false; }
+	}
+
+	LensStream stream;
+	if (!OpenLensShard(job.lensPath, job.plan, node, &stream)) { *error = "node " + std::to_string(node) + " couldn't read its shard of " + job.lensPath + ", or its copy differs from the coordinator's"; return false; }
+	StreamingSweep(&stream, job.raysPerBlock, job.eta, job.light, job.distances, job.width, job.height, images);
+	if (stream.malformedLines > 0) { std::cout << "Skipped " << stream.malformedLines << " malformed vertex/normal lines\n"; }
+
+	for (int c = 0; c < 2; c++) {
+		if (children[c] < numNodes && !ReceiveResult(connections[c].fd, children[c], job, images, error)) { return false; }
+	}
+	return true;
+}
+
+bool DistributedSweep(const ClusterJob& job, std::vector<Irradiance>* images) {
+	if (job.plan.shards.size() != job.workers.size() + 1) { std::cout << "The lens has to be split into one shard per node\n"; return false; }
+	if (!JobFits(job)) { std::cout << "The images are too big to send to the nodes, " << maxClusterHistogramFloats << " pixels across all the distances at most\n"; return false; }
+	if (job.timeoutSeconds <= 0) { std::cout << "The node timeout has to be at least a second\n"; return false; }
+	std::string error;
+	if (!RunNode(job, 0, images, &error)) { std::cout << "Distributed sweep failed, " << error << "\n"; return false; }
+	return true;
+}
+
+bool ServeSweeps(const std::string& bindAddress, int port) {
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	addrinfo* found = nullptr;
+	Socket listener;
+	if (getaddrinfo(bindAddress.c_str(), std::to_string(port).c_str(), &hints, &found) == 0) {
+		for (addrinfo* candidate = found; candidate != nullptr && listener.fd < 0; candidate = candidate->ai_next) {
+			listener.fd = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+			int reuse = 1;
+			if (listener.fd >= 0 && (setsockopt(listener.fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+				bind(listener.fd, candidate->ai_addr, candidate->ai_addrlen) != 0 || listen(listener.fd, 4) != 0)) {
+				close(listener.fd);
+				listener.fd = -1;
+			}
+		}
+		freeaddrinfo(found);
+	}
+	if (listener.fd < 0) { std::cout << "Couldn't listen on " << bindAddress << " port " << port << "\n"; return false; }
+	std::cout << "Waiting for sweeps on " << bindAddress << " port " << port << "\n";
+
+	for (;;) {	//one job at a time, a node is only ever asked for one shard of a sweep
+		Socket connection(accept(listener.fd, nullptr, nullptr));
+		if (connection.fd < 0) { continue; }
+		ClusterJob job;
+		size_t node = 0;
+		if (!SetTimeout(connection.fd, jobTimeoutSeconds) || !ReceiveJob(connection.fd, &job, &node)) { std::cout << "Ignoring a connection that didn't send a job\n"; continue; }
+		std::cout << "Node " << node << " of " << job.plan.shards.size() << ", " << job.plan.shards[node].numRays << " rays of " << job.lensPath << " at " << job.distances.size() << " distances\n";
+		std::vector<Irradiance> images;
+		std::string error;
+		bool ok = RunNode(job, node, &images, &error);
+		if (!ok) { std::cout << "Failed, " << error << "\n"; }
+		if (!SetTimeout(connection.fd, job.timeoutSeconds) || !SendResult(connection.fd, ok, error, images)) { std::cout << "Lost the connection to node " << (node - 1) / 2 << "\n"; }	//the parent may still be busy with its own shard when this starts sending
+	}
+}
+
+#endif
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "irradiance.h"
+#include "refract.h"
+
+//focus sweeps split across machines, each node streams its own shard of the lens and only the finished histograms travel, so the traffic goes with the image size instead of the ray count
+//the nodes form a binary tree over plain TCP, node i passes the job on to nodes 2i+1 and 2i+2 and sends the sum of its whole subtree back to its parent, the coordinator is node 0
+//every node has to see the lens at the same path with the same contents and share a byte order, numbers go over the wire as they sit in memory like they do in the .lensbin
+//there's no authentication, a job names the file a worker reads and the addresses it passes the job on to, so workers trust whoever reaches their port and should only be reachable from inside the cluster
+
+const size_t defaultClusterBlockRays = size_t(1) << 22;	//rays per block on each node when --stream doesn't say
+const int defaultNodeTimeoutSeconds = 600;					//how long a node waits on a child that has gone quiet, when --node-timeout doesn't say
+const uint64_t maxClusterHistogramFloats = uint64_t(1) << 28;	//distances times pixels in one job, 1GB of images on every node, anything bigger is refused before a node allocates for it
+const char defaultServeAddress[] = "127.0.0.1";				//--serve listens on loopback only unless --bind opens it to a network
+
+struct ClusterJob {	//everything a node needs to render its part of a sweep
+	std::string lensPath;
+	LensShardPlan plan;					//one shard per node
+	std::vector<std::string> workers;	//host:port of nodes 1 and up, in order
+	size_t raysPerBlock = defaultClusterBlockRays;
+	double eta = 0;
+	Light light;
+	std::vector<double> distances;
+	int width = 0, height = 0;
+	int timeoutSeconds = defaultNodeTimeoutSeconds;	//for every connection between nodes, has to be longer than the slowest node takes over its own shard since its parent waits that long for it
+};
+
+bool DistributedSweep(const ClusterJob& job, std::vector<Irradiance>* images);	//renders shard 0 here and sums the rest in from the workers, the same images as StreamingSweep of the whole lens, false with the reason printed if any node fails
+bool ServeSweeps(const std::string& bindAddress, int port);	//runs jobs for whoever connects, one at a time until the process is killed, false if it can't listen on port at bindAddress
+//a connection gets a few seconds to send its job before it's dropped, so one that never does can't hold the worker up
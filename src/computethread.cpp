@@ -0,0 +1,119 @@
+#include "computethread.h"
+
+#include <algorithm>
+
+#include "spectrum.h"
+#include "statistics.h"
+#include "sweep.h"
+
+const size_t progressiveRays = size_t(1) << 21;	//lenses with more rays than this on screen get drawn a level of detail at a time, and this is also how many rays go between checks for a new request
+
+ComputeThread::ComputeThread(ComputeSettings settings, std::function<void()> frameReady) : settings(std::move(settings)), frameReady(std::move(frameReady)), thread([this]() { Run(); }) {}
+
+ComputeThread::~ComputeThread() {
+	stopping.store(true, std::memory_order_relaxed);
+	numRequests.fetch_add(1, std::memory_order_release);
+	numRequests.notify_one();
+	thread.join();
+}
+
+void ComputeThread::Request(const ViewRequest& view) {
+	requests.Back() = view;
+	requests.Publish();
+	numRequests.fetch_add(1, std::memory_order_release);	//after publishing, so a thread that wakes up on this is sure to find it
+	numRequests.notify_one();
+}
+
+const Frame* ComputeThread::TakeFrame() { return frames.Take() ? &frames.Front() : nullptr; }
+
+void ComputeThread::Run() {
+	while (!stopping.load(std::memory_order_relaxed)) {
+		uint64_t seen = numRequests.load(std::memory_order_acquire);	//before looking, so a request that comes in after the look still wakes the wait
+		if (requests.Take()) { Start(requests.Front()); }	//a burst of requests only draws the last of them
+		else if (level < previewLevels) { Refine(); }
+		else { numRequests.wait(seen, std::memory_order_acquire); }
+	}
+}
+
+void ComputeThread::Start(const ViewRequest& request) {
+	ScopedTimer timer(Stage::Draw);	//the whole frame, so it includes the intersect, accumulate and tone map times inside it
+	bool etaChanged = !prepared || request.eta != view.eta;
+	view = request;
+	level = previewLevels;	//whatever was still being refined is for the old view
+	done = 0;
+
+	if (settings.numBands > 0) {	//colour version, one histogram per wavelength
+		if (etaChanged) {	//the whole spectrum moves with the index
+			std::vector<SpectralBand> spectrum = MakeSpectralBands(settings.numBands, view.eta, settings.glassModel);
+			std::vector<double> bandEtas;
+			bandWeights.clear();
+			for (const SpectralBand& band : spectrum) {
+				bandEtas.push_back(band.eta);
+				bandWeights.push_back(band.weights);
+			}
+			PrepareDispersedIntersections(settings.vertices, settings.normals, bandEtas, &bands, settings.light);	//every wavelength in one pass over the lens
+			prepared = true;
+		}
+		bandIrradiances.resize(bands.size());
+		for (size_t band = 0; band < bands.size(); band++) {	//the intersections buffer is shared, only one band's worth is alive at a time
+			Irradiance& bandIrradiance = bandIrradiances[band];
+			if (bandIrradiance.width != view.width || bandIrradiance.height != view.height) { bandIrradiance.Resize(view.width, view.height); }
+			CalculateIntersections(bands[band], &intersections, view.receiverPlane);
+			AccumulateIrradiance(intersections, &bandIrradiance);
+		}
+		Publish(true);
+		return;
+	}
+	if (settings.samplesPerTriangle > 0) {	//traces the supersampled rays from scratch every time, they're never stored
+		SupersampledSweep(settings.vertices, settings.normals, settings.triangles, settings.samplesPerTriangle, view.eta, settings.light, std::span<const double>(&view.receiverPlane, 1), view.width, view.height, &sampledIrradiance);
+		Publish(true);
+		return;
+	}
+
+	viewed = settings.quantizedLens ? &refractionCache.Get(settings.lensHash, view.eta, settings.light, view.receiverPlane, settings.quantized) :
+		&refractionCache.Get(settings.lensHash, view.eta, settings.light, settings.slabThickness, view.receiverPlane, settings.vertices, settings.normals);	//a new index refracts or comes out of the cache, moving the plane only recompacts now and then
+	if (settings.binTiles) {	//the tile order was made from the lens geometry, so it's reused as the plane moves until too many rays have drifted out of their tiles
+		if (binnedVersion != refractionCache.Version() || tileBins.NeedsRebinning(view.width, view.height)) {
+			BinIntersections(*viewed, view.receiverPlane, view.width, view.height, &tileBins);
+			binnedVersion = refractionCache.Version();
+		}
+		AccumulateBinned(&tileBins, view.receiverPlane, &irradiance);	//intersects as it goes, and sizes the histogram to match the bins
+		Publish(true);
+		return;
+	}
+	if (irradiance.width != view.width || irradiance.height != view.height) { irradiance.Resize(view.width, view.height); }
+	if (settings.progressive && viewed->size() > progressiveRays) {	//the coarsest level now even if another request is waiting, so holding a key down still shows something, the rest a batch at a time until one comes in
+		level = 0;
+		while (level == 0) { Refine(); }
+		return;
+	}
+	CalculateIntersections(*viewed, &intersections, view.receiverPlane);
+	AccumulateIrradiance(intersections, &irradiance);	//count the rays landing in each pixel instead of drawing them one by one
+	Publish(true);
+}
+
+void ComputeThread::Refine() {
+	ScopedTimer timer(Stage::Draw);
+	size_t levelEnd = PreviewLevelEnd(viewed->size(), level);
+	size_t end = std::min(levelEnd, done + progressiveRays);
+	CalculateIntersections(*viewed, done, end, &intersections, view.receiverPlane);
+	AccumulateIrradiance(intersections, &irradiance, done > 0);	//each level only adds the rays the one before didn't have
+	done = end;
+	if (end < levelEnd) { return; }
+	level++;
+	Publish(level == previewLevels);	//the tone curve is relative to the average lit pixel, so a coarse level comes out as bright as the finished image
+}
+
+void ComputeThread::Publish(bool complete) {
+	const Irradiance& image = settings.numBands > 0 ? bandIrradiances[0] : settings.samplesPerTriangle > 0 ? sampledIrradiance[0] : irradiance;	//the bands are all the same size
+	Frame& frame = frames.Back();
+	frame.width = image.width;
+	frame.height = image.height;
+	frame.argb.resize(size_t(image.width) * size_t(image.height));
+	if (settings.numBands > 0) { ToneMap(bandIrradiances, bandWeights, frame.argb.data(), image.width); }
+	else { ToneMap(image, frame.argb.data(), image.width); }
+	frame.view = view;
+	frame.complete = complete;
+	frames.Publish();
+	frameReady();
+}
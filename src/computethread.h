@@ -0,0 +1,88 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "binning.h"
+#include "irradiance.h"
+#include "lenscache.h"
+#include "mailbox.h"
+#include "raybuffer.h"
+#include "refract.h"
+#include "refractioncache.h"
+
+//the viewer's solver on a thread of its own, so the window keeps handling events, resizes and quitting however long a frame takes
+//the event loop posts the view it wants and picks up the newest finished frame, neither side ever waits on the other
+
+struct ViewRequest {	//what the window wants drawn
+	double receiverPlane = 0;
+	double eta = 0;
+	int width = 0, height = 0;	//the irradiance size, the window's size when it asked
+};
+
+struct Frame {	//a tone mapped image ready to upload
+	int width = 0, height = 0;
+	std::vector<uint32_t> argb;	//ARGB8888, width x height with no row padding
+	ViewRequest view;			//what it's a picture of
+	bool complete = false;		//false for the coarse levels of a progressive draw, there's a finer one on its way
+};
+
+struct ComputeSettings {	//the lens and how to draw it, fixed for as long as the viewer runs
+	RayBuffer vertices;
+	RayBuffer normals;
+	QuantizedLens quantized;			//used instead of the two above when quantizedLens is set
+	bool quantizedLens = false;
+	std::vector<Triangle> triangles;	//only kept when supersampling
+	uint64_t lensHash = 0;
+	Light light;
+	double slabThickness = -1;			//negative for the single surface model
+	int numBands = 0;					//colour with this many wavelengths when more than 0
+	std::string glassModel = "cauchy";
+	int samplesPerTriangle = 0;
+	bool progressive = true;			//big lenses get drawn a level of detail at a time, see PreviewLevelEnd
+	bool binTiles = false;				//splat a screen tile at a time, see BinIntersections
+};
+
+class ComputeThread {
+public:
+	ComputeThread(ComputeSettings settings, std::function<void()> frameReady);	//frameReady is called on the compute thread after every frame it publishes, so it has to be safe to call from there
+	~ComputeThread();	//lets the batch of rays in flight finish, then joins
+	ComputeThread(const ComputeThread&) = delete;
+	ComputeThread& operator=(const ComputeThread&) = delete;
+
+	void Request(const ViewRequest& view);	//replaces any request the thread hasn't started on yet and cancels what's left of a progressive draw, only call from one thread
+	const Frame* TakeFrame();				//the newest frame finished since the last call or nullptr, valid until the next call, only call from one thread
+
+private:
+	void Run();
+	void Start(const ViewRequest& request);	//draws the whole frame, or the coarsest level of it when it's drawn progressively
+	void Refine();							//the next batch of a progressive draw
+	void Publish(bool complete);			//tone maps whichever histograms the current mode fills into the next frame
+
+	ComputeSettings settings;
+	std::function<void()> frameReady;
+	Mailbox<ViewRequest> requests;
+	Mailbox<Frame> frames;
+	std::atomic<uint64_t> numRequests{0};	//goes up with every request and on shutdown, the thread sleeps on it when it has nothing left to draw
+	std::atomic<bool> stopping{false};
+
+	//everything from here down is only touched on the compute thread
+	ViewRequest view;						//the view being drawn
+	bool prepared = false;					//whether the dispersed bands are set up for view.eta
+	RefractionCache refractionCache;		//the affine intersections for the indices used recently, so E/D back to an earlier index is instant
+	const AffineIntersections* viewed = nullptr;	//the rays in refractionCache that can land on screen at the current index and distance
+	std::vector<AffineIntersections> bands;	//one per wavelength, when rendering with dispersion
+	std::vector<ChannelWeights> bandWeights;
+	PointBuffer intersections;
+	TileBins tileBins;
+	uint64_t binnedVersion = 0;				//the refractionCache version tileBins was made from
+	Irradiance irradiance;
+	std::vector<Irradiance> bandIrradiances;
+	std::vector<Irradiance> sampledIrradiance;	//just the one, the supersampled rays go through the sweep with a single distance
+	int level = previewLevels;				//the progressive level being drawn, previewLevels when the frame is finished
+	size_t done = 0;						//rays of *viewed already in irradiance, always a prefix
+
+	std::thread thread;	//last, so everything above is set up before it starts
+};
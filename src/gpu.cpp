@@ -0,0 +1,344 @@
+#ifdef CAUSTICS_GPU	//build with -DCAUSTICS_GPU to get the OpenGL 4.3 compute backend, the CPU path is always there and stays the reference
+
+#include "refract.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "SDL.h"
+#include "GL/glcorearb.h"
+
+//every GL entry point we use, loaded through SDL so we don't need a separate loader library
+#define CAUSTICS_GL_FUNCTIONS(X) \
+	X(PFNGLCREATESHADERPROC, glCreateShader) \
+	X(PFNGLSHADERSOURCEPROC, glShaderSource) \
+	X(PFNGLCOMPILESHADERPROC, glCompileShader) \
+	X(PFNGLGETSHADERIVPROC, glGetShaderiv) \
+	X(PFNGLGETSHADERINFOLOGPROC, glGetShaderInfoLog) \
+	X(PFNGLDELETESHADERPROC, glDeleteShader) \
+	X(PFNGLCREATEPROGRAMPROC, glCreateProgram) \
+	X(PFNGLATTACHSHADERPROC, glAttachShader) \
+	X(PFNGLLINKPROGRAMPROC, glLinkProgram) \
+	X(PFNGLGETPROGRAMIVPROC, glGetProgramiv) \
+	X(PFNGLGETPROGRAMINFOLOGPROC, glGetProgramInfoLog) \
+	X(PFNGLDELETEPROGRAMPROC, glDeleteProgram) \
+	X(PFNGLUSEPROGRAMPROC, glUseProgram) \
+	X(PFNGLGETUNIFORMLOCATIONPROC, glGetUniformLocation) \
+	X(PFNGLUNIFORM1FPROC, glUniform1f) \
+	X(PFNGLUNIFORM1UIPROC, glUniform1ui) \
+	X(PFNGLUNIFORM2IPROC, glUniform2i) \
+	X(PFNGLGENBUFFERSPROC, glGenBuffers) \
+	X(PFNGLDELETEBUFFERSPROC, glDeleteBuffers) \
+	X(PFNGLBINDBUFFERPROC, glBindBuffer) \
+	X(PFNGLBUFFERDATAPROC, glBufferData) \
+	X(PFNGLBINDBUFFERBASEPROC, glBindBufferBase) \
+	X(PFNGLCLEARBUFFERDATAPROC, glClearBufferData) \
+	X(PFNGLDISPATCHCOMPUTEPROC, glDispatchCompute) \
+	X(PFNGLMEMORYBARRIERPROC, glMemoryBarrier) \
+	X(PFNGLGENVERTEXARRAYSPROC, glGenVertexArrays) \
+	X(PFNGLDELETEVERTEXARRAYSPROC, glDeleteVertexArrays) \
+	X(PFNGLBINDVERTEXARRAYPROC, glBindVertexArray) \
+	X(PFNGLDRAWARRAYSPROC, glDrawArrays) \
+	X(PFNGLVIEWPORTPROC, glViewport) \
+	X(PFNGLGETINTEGERI_VPROC, glGetIntegeri_v)
+
+#define CAUSTICS_DECLARE_GL(type, name) static type name = nullptr;
+CAUSTICS_GL_FUNCTIONS(CAUSTICS_DECLARE_GL)
+#undef CAUSTICS_DECLARE_GL
+
+static bool LoadGLFunctions() {
+	bool loaded = true;
+#define CAUSTICS_LOAD_GL(type, name) name = reinterpret_cast<type>(SDL_GL_GetProcAddress(#name)); if (name == nullptr) { std::cout << "Missing GL function " #name "\n"; loaded = false; }
+	CAUSTICS_GL_FUNCTIONS(CAUSTICS_LOAD_GL)
+#undef CAUSTICS_LOAD_GL
+	return loaded;
+}
+
+const unsigned workGroupSize = 256;	//matches local_size_x in the compute shaders
+
+//the shaders run the same math as the CPU kernels in refract.cpp, in single precision, and loop grid-stride so any ray count fits in one dispatch
+
+static const char* refractShader = R"(#version 430
+layout(local_size_x = 256) in;
+layout(std430, binding = 0) readonly buffer NormalX { float nx[]; };
+layout(std430, binding = 1) readonly buffer NormalY { float ny[]; };
+layout(std430, binding = 2) readonly buffer NormalZ { float nz[]; };
+layout(std430, binding = 3) writeonly buffer RefractedX { float rx[]; };
+layout(std430, binding = 4) writeonly buffer RefractedY { float ry[]; };
+layout(std430, binding = 5) writeonly buffer RefractedZ { float rz[]; };
+uniform float eta;
+uniform uint count;
+void main() {
+	for (uint i = gl_GlobalInvocationID.x; i < count; i += gl_NumWorkGroups.x * gl_WorkGroupSize.x) {
+		float cosIncidenceAngle = nz[i];
+		float sinRefractedAngle2 = eta * eta * (1.0 - cosIncidenceAngle * cosIncidenceAngle);
+		if (sinRefractedAngle2 <= 1.0) {
+			float k = eta * cosIncidenceAngle - sqrt(1.0 - sinRefractedAngle2);
+			rx[i] = -k * nx[i];
+			ry[i] = -k * ny[i];
+			rz[i] = eta - k * cosIncidenceAngle;
+		}
+		else {
+			rx[i] = 0.9999;
+			ry[i] = 0.0;
+			rz[i] = 0.0141418;
+		}
+	}
+}
+)";
+
+static const char* splatShader = R"(#version 430
+layout(local_size_x = 256) in;
+layout(std430, binding = 0) readonly buffer VertexX { float vx[]; };
+layout(std430, binding = 1) readonly buffer VertexY { float vy[]; };
+layout(std430, binding = 2) readonly buffer VertexZ { float vz[]; };
+layout(std430, binding = 3) readonly buffer RefractedX { float rx[]; };
+layout(std430, binding = 4) readonly buffer RefractedY { float ry[]; };
+layout(std430, binding = 5) readonly buffer RefractedZ { float rz[]; };
+layout(std430, binding = 6) buffer Histogram { uint histogram[]; };
+uniform float receiverPlane;
+uniform uint count;
+uniform ivec2 size;
+void main() {
+	vec2 scale = vec2(size) / 256.0;
+	for (uint i = gl_GlobalInvocationID.x; i < count; i += gl_NumWorkGroups.x * gl_WorkGroupSize.x) {
+		float t = (receiverPlane - vz[i]) / rz[i];
+		vec2 intersection = (vec2(vx[i], vy[i]) + vec2(rx[i], ry[i]) * t) * 128.0 + 128.0;
+		vec2 pixel = intersection * scale;
+		if (pixel.x >= 0.0 && pixel.x < float(size.x) && pixel.y >= 0.0 && pixel.y < float(size.y)) {
+			atomicAdd(histogram[uint(pixel.y) * uint(size.x) + uint(pixel.x)], 1u);
+		}
+	}
+}
+)";
+
+static const char* statsShader = R"(#version 430
+layout(local_size_x = 256) in;
+layout(std430, binding = 6) readonly buffer Histogram { uint histogram[]; };
+layout(std430, binding = 7) buffer Stats { uint litPixels; uint totalRays; };
+uniform uint count;
+shared uint groupLit;
+shared uint groupTotal;
+void main() {
+	if (gl_LocalInvocationIndex == 0) { groupLit = 0u; groupTotal = 0u; }
+	barrier();
+	uint lit = 0u, total = 0u;
+	for (uint i = gl_GlobalInvocationID.x; i < count; i += gl_NumWorkGroups.x * gl_WorkGroupSize.x) {
+		lit += histogram[i] > 0u ? 1u : 0u;
+		total += histogram[i];
+	}
+	atomicAdd(groupLit, lit);
+	atomicAdd(groupTotal, total);
+	barrier();
+	if (gl_LocalInvocationIndex == 0) { atomicAdd(litPixels, groupLit); atomicAdd(totalRays, groupTotal); }
+}
+)";
+
+static const char* presentVertexShader = R"(#version 430
+void main() {
+	vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+static const char* presentFragmentShader = R"(#version 430
+layout(std430, binding = 6) readonly buffer Histogram { uint histogram[]; };
+layout(std430, binding = 7) readonly buffer Stats { uint litPixels; uint totalRays; };
+uniform ivec2 histogramSize;
+uniform ivec2 drawableSize;
+out vec4 color;
+void main() {
+	ivec2 pixel = ivec2(gl_FragCoord.xy * vec2(histogramSize) / vec2(drawableSize));
+	pixel = clamp(pixel, ivec2(0), histogramSize - 1);
+	uint value = histogram[uint(histogramSize.y - 1 - pixel.y) * uint(histogramSize.x) + uint(pixel.x)];	//gl's rows go bottom up, the image's go top down
+	float averageLit = litPixels > 0u ? float(totalRays) / float(litPixels) : 1.0;
+	float relative = float(value) / averageLit;
+	float grey = sqrt(relative / (1.0 + relative));	//same curve as ToneMap in irradiance.cpp
+	color = vec4(grey, grey, grey, 1.0);
+}
+)";
+
+struct GPURays {
+	GLuint vertexBuffers[3] = {};
+	GLuint normalBuffers[3] = {};
+	GLuint refractedBuffers[3] = {};
+	GLuint histogramBuffer = 0;
+	GLuint statsBuffer = 0;
+	GLuint refractProgram = 0;
+	GLuint splatProgram = 0;
+	GLuint statsProgram = 0;
+	GLuint presentProgram = 0;
+	GLuint emptyVertexArray = 0;	//core profile won't draw without one bound, even with no attributes
+	GLuint count = 0;
+	int histogramWidth = 0;
+	int histogramHeight = 0;
+	GLuint maxWorkGroups = 65535;
+};
+
+static GLuint CompileShader(GLenum type, const char* source) {
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source, nullptr);
+	glCompileShader(shader);
+	GLint compiled = 0;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+	if (!compiled) {
+		char log[1024];
+		glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+		std::cout << "Shader compile failed: " << log << "\n";
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+static GLuint LinkProgram(std::initializer_list<GLuint> shaders) {	//takes ownership of the shaders
+	GLuint program = glCreateProgram();
+	bool valid = true;
+	for (GLuint shader : shaders) {
+		if (shader == 0) { valid = false; continue; }
+		glAttachShader(program, shader);
+	}
+	if (valid) { glLinkProgram(program); }
+	for (GLuint shader : shaders) { if (shader != 0) { glDeleteShader(shader); } }
+
+	GLint linked = 0;
+	if (valid) { glGetProgramiv(program, GL_LINK_STATUS, &linked); }
+	if (!linked) {
+		char log[1024] = {};
+		if (valid) { glGetProgramInfoLog(program, sizeof(log), nullptr, log); }
+		std::cout << "Shader link failed: " << log << "\n";
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+static void UploadComponent(GLuint buffer, const AlignedVector<Real>& component) {	//the gpu works in floats whatever precision the CPU side was built with
+	std::vector<float> values(component.begin(), component.end());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(values.size() * sizeof(float)), values.data(), GL_STATIC_DRAW);
+}
+
+static GLuint NumWorkGroups(const GPURays* rays, GLuint count) {
+	return std::max<GLuint>(1, std::min<GLuint>(rays->maxWorkGroups, (count + workGroupSize - 1) / workGroupSize));
+}
+
+GPURays* CreateGPURays(const RayBuffer& vertices, const RayBuffer& normals) {
+	if (!LoadGLFunctions()) { return nullptr; }
+	if (vertices.size() > size_t(UINT32_MAX)) { std::cout << "Too many rays for the GPU backend\n"; return nullptr; }
+
+	GPURays* rays = new GPURays();
+	rays->refractProgram = LinkProgram({ CompileShader(GL_COMPUTE_SHADER, refractShader) });
+	rays->splatProgram = LinkProgram({ CompileShader(GL_COMPUTE_SHADER, splatShader) });
+	rays->statsProgram = LinkProgram({ CompileShader(GL_COMPUTE_SHADER, statsShader) });
+	rays->presentProgram = LinkProgram({ CompileShader(GL_VERTEX_SHADER, presentVertexShader), CompileShader(GL_FRAGMENT_SHADER, presentFragmentShader) });
+	if (!rays->refractProgram || !rays->splatProgram || !rays->statsProgram || !rays->presentProgram) {
+		DestroyGPURays(rays);
+		return nullptr;
+	}
+
+	GLint maxWorkGroups = 0;
+	glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &maxWorkGroups);
+	if (maxWorkGroups > 0) { rays->maxWorkGroups = GLuint(maxWorkGroups); }
+
+	glGenBuffers(3, rays->vertexBuffers);
+	glGenBuffers(3, rays->normalBuffers);
+	glGenBuffers(3, rays->refractedBuffers);
+	glGenBuffers(1, &rays->histogramBuffer);
+	glGenBuffers(1, &rays->statsBuffer);
+	glGenVertexArrays(1, &rays->emptyVertexArray);
+
+	rays->count = GLuint(vertices.size());
+	UploadComponent(rays->vertexBuffers[0], vertices.x);	//everything stays resident on the device from here on
+	UploadComponent(rays->vertexBuffers[1], vertices.y);
+	UploadComponent(rays->vertexBuffers[2], vertices.z);
+	UploadComponent(rays->normalBuffers[0], normals.x);
+	UploadComponent(rays->normalBuffers[1], normals.y);
+	UploadComponent(rays->normalBuffers[2], normals.z);
+	for (GLuint buffer : rays->refractedBuffers) {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(size_t(rays->count) * sizeof(float)), nullptr, GL_DYNAMIC_COPY);
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, rays->statsBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+	return rays;
+}
+
+void DestroyGPURays(GPURays* rays) {
+	if (rays == nullptr) { return; }
+	if (glDeleteBuffers != nullptr) {
+		glDeleteBuffers(3, rays->vertexBuffers);
+		glDeleteBuffers(3, rays->normalBuffers);
+		glDeleteBuffers(3, rays->refractedBuffers);
+		glDeleteBuffers(1, &rays->histogramBuffer);
+		glDeleteBuffers(1, &rays->statsBuffer);
+		glDeleteVertexArrays(1, &rays->emptyVertexArray);
+		glDeleteProgram(rays->refractProgram);
+		glDeleteProgram(rays->splatProgram);
+		glDeleteProgram(rays->statsProgram);
+		glDeleteProgram(rays->presentProgram);
+	}
+	delete rays;
+}
+
+void Refract(GPURays* rays, double eta) {
+	for (int i = 0; i < 3; i++) {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GLuint(i), rays->normalBuffers[i]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GLuint(3 + i), rays->refractedBuffers[i]);
+	}
+	glUseProgram(rays->refractProgram);
+	glUniform1f(glGetUniformLocation(rays->refractProgram, "eta"), float(eta));
+	glUniform1ui(glGetUniformLocation(rays->refractProgram, "count"), rays->count);
+	glDispatchCompute(NumWorkGroups(rays, rays->count), 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void CalculateIntersections(GPURays* rays, double receiver_plane, int width, int height) {
+	GLuint numPixels = GLuint(width) * GLuint(height);
+	if (width != rays->histogramWidth || height != rays->histogramHeight) {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, rays->histogramBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(numPixels * sizeof(GLuint)), nullptr, GL_DYNAMIC_COPY);
+		rays->histogramWidth = width;
+		rays->histogramHeight = height;
+	}
+	const GLuint zero = 0;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, rays->histogramBuffer);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, rays->statsBuffer);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+	for (int i = 0; i < 3; i++) {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GLuint(i), rays->vertexBuffers[i]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GLuint(3 + i), rays->refractedBuffers[i]);
+	}
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, rays->histogramBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, rays->statsBuffer);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glUseProgram(rays->splatProgram);
+	glUniform1f(glGetUniformLocation(rays->splatProgram, "receiverPlane"), float(receiver_plane));
+	glUniform1ui(glGetUniformLocation(rays->splatProgram, "count"), rays->count);
+	glUniform2i(glGetUniformLocation(rays->splatProgram, "size"), width, height);
+	glDispatchCompute(NumWorkGroups(rays, rays->count), 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glUseProgram(rays->statsProgram);	//average lit pixel for the tone map, worked out on the device so nothing has to come back
+	glUniform1ui(glGetUniformLocation(rays->statsProgram, "count"), numPixels);
+	glDispatchCompute(NumWorkGroups(rays, numPixels), 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void PresentIrradiance(GPURays* rays, int drawableWidth, int drawableHeight) {
+	if (rays->histogramWidth == 0 || rays->histogramHeight == 0) { return; }
+	glViewport(0, 0, drawableWidth, drawableHeight);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, rays->histogramBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, rays->statsBuffer);
+	glUseProgram(rays->presentProgram);
+	glUniform2i(glGetUniformLocation(rays->presentProgram, "histogramSize"), rays->histogramWidth, rays->histogramHeight);
+	glUniform2i(glGetUniformLocation(rays->presentProgram, "drawableSize"), drawableWidth, drawableHeight);
+	glBindVertexArray(rays->emptyVertexArray);
+	glDrawArrays(GL_TRIANGLES, 0, 3);	//one triangle that covers the whole window
+}
+
+#endif
@@ -0,0 +1,400 @@
+#include "image.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+#include "mappedfile.h"
+
+//just enough of inflate (RFC 1951) to read png files without pulling in zlib, decoding works the way zlib's puff does, one bit of the code at a time against the counts of each code length
+
+struct BitReader {
+	const uint8_t* data;
+	size_t size;
+	size_t position = 0;	//next byte to read
+	uint32_t buffer = 0;	//bits read but not used yet, the next one is the lowest
+	int count = 0;
+	bool overrun = false;	//set once we've tried to read past the end, the output is garbage after that
+
+	uint32_t Bits(int n) {
+		while (count < n) {
+			if (position == size) { overrun = true; return 0; }
+			buffer |= uint32_t(data[position++]) << count;
+			count += 8;
+		}
+		uint32_t bits = buffer & ((uint32_t(1) << n) - 1);
+		buffer >>= n;
+		count -= n;
+		return bits;
+	}
+};
+
+struct Huffman {
+	uint16_t counts[16] = {};	//number of codes of each length
+	uint16_t symbols[288] = {};	//symbols ordered by code
+};
+
+static bool BuildHuffman(const uint8_t* lengths, int numSymbols, Huffman* huffman) {
+	for (int i = 0; i < numSymbols; i++) { huffman->counts[lengths[i]]++; }
+	huffman->counts[0] = 0;
+	int left = 1;	//codes still available at the current length, RFC 1951 only allows over-subscribed sets to fail
+	for (int length = 1; length < 16; length++) {
+		left = left * 2 - huffman->counts[length];
+		if (left < 0) { return false; }
+	}
+	uint16_t offsets[16] = {};
+	for (int length = 1; length < 15; length++) { offsets[length + 1] = offsets[length] + huffman->counts[length]; }
+	for (int i = 0; i < numSymbols; i++) {
+		if (lengths[i] != 0) { huffman->symbols[offsets[lengths[i]]++] = uint16_t(i); }
+	}
+	return true;
+}
+
+static int DecodeSymbol(BitReader* reader, const Huffman& huffman) {	//-1 for a code that isn't in the table
+	int code = 0, first = 0, index = 0;
+	for (int length = 1; length < 16; length++) {
+		code |= int(reader->Bits(1));
+		int count = huffman.counts[length];
+		if (code - first < count) { return huffman.symbols[index + code - first]; }
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+	return -1;
+}
+
+static bool InflateBlock(BitReader* reader, const Huffman& lengthCodes, const Huffman& distanceCodes, std::vector<uint8_t>* output) {
+	static const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	static const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	static const uint16_t distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+	static const uint8_t distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+	while (!reader->overrun) {
+		int symbol = DecodeSymbol(reader, lengthCodes);
+		if (symbol < 0) { return false; }
+		if (symbol < 256) { output->push_back(uint8_t(symbol)); continue; }
+		if (symbol == 256) { return true; }	//end of block
+		symbol -= 257;
+		if (symbol >= 29) { return false; }
+		size_t length = lengthBase[symbol] + reader->Bits(lengthExtra[symbol]);
+		int distanceSymbol = DecodeSymbol(reader, distanceCodes);
+		if (distanceSymbol < 0 || distanceSymbol >= 30) { return false; }
+		size_t distance = distanceBase[distanceSymbol] + reader->Bits(distanceExtra[distanceSymbol]);
+		if (distance > output->size()) { return false; }
+		size_t from = output->size() - distance;
+		for (size_t i = 0; i < length; i++) { output->push_back((*output)[from + i]); }	//byte at a time, the copy is allowed to overlap what it's writing
+	}
+	return false;
+}
+
+static bool Inflate(const uint8_t* data, size_t size, std::vector<uint8_t>* output) {	//raw deflate stream, without the zlib header
+	BitReader reader{ data, size };
+	bool last = false;
+	while (!last) {
+		last = reader.Bits(1) != 0;
+		uint32_t type = reader.Bits(2);
+		if (type == 0) {	//stored
+			reader.buffer = 0;	//the length starts on the next byte boundary
+			reader.count = 0;
+			if (reader.position + 4 > size) { return false; }
+			const uint8_t* p = data + reader.position;
+			size_t length = p[0] | (p[1] << 8);
+			if ((length ^ (p[2] | (p[3] << 8))) != 0xffff) { return false; }
+			reader.position += 4;
+			if (reader.position + length > size) { return false; }
+			output->insert(output->end(), data + reader.position, data + reader.position + length);
+			reader.position += length;
+			continue;
+		}
+
+		Huffman lengthCodes, distanceCodes;
+		uint8_t lengths[320] = {};
+		int numLengthCodes = 288, numDistanceCodes = 30;
+		if (type == 1) {	//fixed codes
+			memset(lengths, 8, 144);
+			memset(lengths + 144, 9, 112);
+			memset(lengths + 256, 7, 24);
+			memset(lengths + 280, 8, 8);
+			memset(lengths + 288, 5, 30);
+		}
+		else if (type == 2) {	//the codes are sent as code lengths, which are themselves huffman coded
+			static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+			numLengthCodes = int(reader.Bits(5)) + 257;
+			numDistanceCodes = int(reader.Bits(5)) + 1;
+			int numCodeLengthCodes = int(reader.Bits(4)) + 4;
+			if (numLengthCodes > 286 || numDistanceCodes > 30) { return false; }
+			uint8_t codeLengthLengths[19] = {};
+			for (int i = 0; i < numCodeLengthCodes; i++) { codeLengthLengths[order[i]] = uint8_t(reader.Bits(3)); }
+			Huffman codeLengthCodes;
+			if (!BuildHuffman(codeLengthLengths, 19, &codeLengthCodes)) { return false; }
+			int total = numLengthCodes + numDistanceCodes;
+			for (int i = 0; i < total;) {
+				int symbol = DecodeSymbol(&reader, codeLengthCodes);
+				if (symbol < 0 || reader.overrun) { return false; }
+				if (symbol < 16) { lengths[i++] = uint8_t(symbol); continue; }
+				uint8_t value = 0;
+				int repeat;
+				if (symbol == 16) {	//repeat the previous length
+					if (i == 0) { return false; }
+					value = lengths[i - 1];
+					repeat = 3 + int(reader.Bits(2));
+				}
+				else if (symbol == 17) { repeat = 3 + int(reader.Bits(3)); }
+				else { repeat = 11 + int(reader.Bits(7)); }
+				if (i + repeat > total) { return false; }
+				while (repeat-- > 0) { lengths[i++] = value; }
+			}
+			if (lengths[256] == 0) { return false; }	//there has to be a way to end the block
+			memmove(lengths + 288, lengths + numLengthCodes, size_t(numDistanceCodes));	//the distance lengths follow straight on from the literal/lengths ones
+			memset(lengths + numLengthCodes, 0, size_t(288 - numLengthCodes));
+		}
+		else { return false; }
+
+		if (!BuildHuffman(lengths, numLengthCodes, &lengthCodes) || !BuildHuffman(lengths + 288, numDistanceCodes, &distanceCodes)) { return false; }
+		if (!InflateBlock(&reader, lengthCodes, distanceCodes, output)) { return false; }
+	}
+	return !reader.overrun;
+}
+
+static uint32_t ReadBigEndian(const uint8_t* p) { return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]); }
+
+static uint8_t Paeth(uint8_t a, uint8_t b, uint8_t c) {	//a is left, b is up, c is up-left
+	int p = int(a) + int(b) - int(c);
+	int pa = p > a ? p - a : a - p, pb = p > b ? p - b : b - p, pc = p > c ? p - c : c - p;
+	return (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+}
+
+bool LoadPNG(const std::string& path, Image* image) {
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	MappedFile file;
+	if (!file.Open(path) || file.size < 8 || memcmp(file.data, signature, 8) != 0) { return false; }
+	const uint8_t* data = reinterpret_cast<const uint8_t*>(file.data);
+
+	uint32_t width = 0, height = 0;
+	int bitDepth = 0, colourType = 0;
+	std::vector<uint8_t> compressed;	//all the IDAT chunks joined together
+	std::vector<float> palette;			//luminance of each palette entry
+	for (size_t position = 8; position + 12 <= file.size;) {	//chunk crcs aren't checked, a corrupt stream gets caught by inflate or the size check instead
+		uint32_t length = ReadBigEndian(data + position);
+		const uint8_t* type = data + position + 4;
+		const uint8_t* chunk = type + 4;
+		if (length > file.size - position - 12) { return false; }
+		if (memcmp(type, "IHDR", 4) == 0 && length >= 13) {
+			width = ReadBigEndian(chunk);
+			height = ReadBigEndian(chunk + 4);
+			bitDepth = chunk[8];
+			colourType = chunk[9];
+			if (chunk[10] != 0 || chunk[11] != 0 || chunk[12] != 0) { return false; }	//we don't do interlacing
+		}
+		else if (memcmp(type, "PLTE", 4) == 0) {
+			for (uint32_t i = 0; i + 3 <= length; i += 3) { palette.push_back((0.2126f * chunk[i] + 0.7152f * chunk[i + 1] + 0.0722f * chunk[i + 2]) / 255.0f); }
+		}
+		else if (memcmp(type, "IDAT", 4) == 0) { compressed.insert(compressed.end(), chunk, chunk + length); }
+		else if (memcmp(type, "IEND", 4) == 0) { break; }
+		position += size_t(length) + 12;
+	}
+
+	int channels;
+	switch (colourType) {
+	case 0: channels = 1; break;	//grey
+	case 2: channels = 3; break;	//rgb
+	case 3: channels = 1; break;	//palette
+	case 4: channels = 2; break;	//grey, alpha
+	case 6: channels = 4; break;	//rgb, alpha
+	default: return false;
+	}
+	bool validDepth = bitDepth == 8 || (bitDepth == 16 && colourType != 3) || ((bitDepth == 1 || bitDepth == 2 || bitDepth == 4) && (colourType == 0 || colourType == 3));
+	if (!validDepth || width == 0 || height == 0 || width > 1 << 16 || height > 1 << 16 || (colourType == 3 && palette.empty())) { return false; }
+	if (compressed.size() < 2 || (compressed[0] & 0x0f) != 8) { return false; }	//zlib header, deflate is the only method
+
+	size_t bitsPerPixel = size_t(channels) * size_t(bitDepth);
+	size_t stride = (size_t(width) * bitsPerPixel + 7) / 8;
+	size_t filterStep = bitsPerPixel < 8 ? 1 : bitsPerPixel / 8;	//bytes back to the same channel of the previous pixel
+	std::vector<uint8_t> raw;
+	raw.reserve((stride + 1) * height);
+	if (!Inflate(compressed.data() + 2, compressed.size() - 2, &raw) || raw.size() < (stride + 1) * height) { return false; }
+
+	std::vector<uint8_t> previous(stride, 0), row(stride);
+	image->width = int(width);
+	image->height = int(height);
+	image->pixels.resize(size_t(width) * height);
+	float maxValue = float((1 << bitDepth) - 1);
+	for (uint32_t y = 0; y < height; y++) {
+		const uint8_t* filtered = raw.data() + y * (stride + 1);
+		uint8_t filter = filtered[0];
+		filtered++;
+		for (size_t i = 0; i < stride; i++) {	//undo the filter against the left, up and up-left bytes that have already been reconstructed
+			uint8_t left = i >= filterStep ? row[i - filterStep] : 0;
+			uint8_t upLeft = i >= filterStep ? previous[i - filterStep] : 0;
+			switch (filter) {
+			case 0: row[i] = filtered[i]; break;
+			case 1: row[i] = uint8_t(filtered[i] + left); break;
+			case 2: row[i] = uint8_t(filtered[i] + previous[i]); break;
+			case 3: row[i] = uint8_t(filtered[i] + ((int(left) + int(previous[i])) >> 1)); break;
+			case 4: row[i] = uint8_t(filtered[i] + Paeth(left, previous[i], upLeft)); break;
+			default: return false;
+			}
+		}
+
+		auto sample = [&](size_t x, int channel) {	//raw sample value, up to maxValue
+			if (bitDepth == 16) { return float((row[(x * channels + channel) * 2] << 8) | row[(x * channels + channel) * 2 + 1]); }
+			if (bitDepth == 8) { return float(row[x * channels + channel]); }
+			size_t bit = x * size_t(bitDepth);
+			return float((row[bit / 8] >> (8 - bitDepth - bit % 8)) & ((1 << bitDepth) - 1));
+		};
+		float* out = image->pixels.data() + size_t(y) * width;
+		for (size_t x = 0; x < width; x++) {
+			switch (colourType) {
+			case 0: out[x] = sample(x, 0) / maxValue; break;
+			case 2: out[x] = (0.2126f * sample(x, 0) + 0.7152f * sample(x, 1) + 0.0722f * sample(x, 2)) / maxValue; break;
+			case 3: {
+				size_t index = size_t(sample(x, 0));
+				out[x] = index < palette.size() ? palette[index] : 0.0f;
+				break;
+			}
+			case 4: out[x] = sample(x, 0) * sample(x, 1) / (maxValue * maxValue); break;
+			case 6: out[x] = (0.2126f * sample(x, 0) + 0.7152f * sample(x, 1) + 0.0722f * sample(x, 2)) * sample(x, 3) / (maxValue * maxValue); break;
+			}
+		}
+		previous.swap(row);
+	}
+	return true;
+}
+
+static uint32_t Crc32(const uint8_t* data, size_t size, uint32_t crc = 0) {	//the one png uses for chunks, pass the previous result to continue it
+	static const auto table = [] {
+		std::vector<uint32_t> entries(256);
+		for (uint32_t n = 0; n < 256; n++) {
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++) { c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1; }
+			entries[n] = c;
+		}
+		return entries;
+	}();
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++) { crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8); }
+	return ~crc;
+}
+
+static void AppendBigEndian(std::vector<uint8_t>* out, uint32_t value) {
+	for (int shift = 24; shift >= 0; shift -= 8) { out->push_back(uint8_t(value >> shift)); }
+}
+
+static void AppendChunk(std::vector<uint8_t>* png, const char* type, const std::vector<uint8_t>& data) {
+	AppendBigEndian(png, uint32_t(data.size()));
+	size_t start = png->size();
+	png->insert(png->end(), type, type + 4);
+	png->insert(png->end(), data.begin(), data.end());
+	AppendBigEndian(png, Crc32(png->data() + start, png->size() - start));
+}
+
+static bool WriteBytes(const std::string& path, const std::vector<uint8_t>& bytes) {
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char*>(bytes.data()), std::streamsize(bytes.size()));
+	return file.good();
+}
+
+bool WritePNG(const std::string& path, int width, int height, const uint16_t* grey) {	//deflate's stored blocks, the files are bigger but there's nothing to spend time on
+	if (width <= 0 || height <= 0) { return false; }
+	size_t stride = size_t(width) * 2 + 1;	//filter byte then big endian samples
+	std::vector<uint8_t> raw(stride * size_t(height));
+	for (int y = 0; y < height; y++) {
+		uint8_t* row = raw.data() + size_t(y) * stride;
+		row[0] = 0;	//no filter
+		for (int x = 0; x < width; x++) {
+			uint16_t value = grey[size_t(y) * width + x];
+			row[1 + 2 * x] = uint8_t(value >> 8);
+			row[2 + 2 * x] = uint8_t(value);
+		}
+	}
+
+	std::vector<uint8_t> compressed = { 0x78, 0x01 };	//zlib header, deflate with a 32K window
+	compressed.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+	size_t position = 0;
+	do {
+		size_t length = std::min<size_t>(raw.size() - position, 65535);
+		bool last = position + length == raw.size();
+		compressed.push_back(last ? 1 : 0);
+		compressed.push_back(uint8_t(length));
+		compressed.push_back(uint8_t(length >> 8));
+		compressed.push_back(uint8_t(~length));
+		compressed.push_back(uint8_t(~length >> 8));
+		compressed.insert(compressed.end(), raw.begin() + position, raw.begin() + position + length);
+		position += length;
+	} while (position < raw.size());
+	uint32_t a = 1, b = 0;	//adler-32 of the uncompressed data
+	for (size_t i = 0; i < raw.size();) {
+		size_t end = std::min(raw.size(), i + 5552);	//the most bytes before the sums can overflow
+		for (; i < end; i++) {
+			a += raw[i];
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	AppendBigEndian(&compressed, (b << 16) | a);
+
+	std::vector<uint8_t> header;
+	AppendBigEndian(&header, uint32_t(width));
+	AppendBigEndian(&header, uint32_t(height));
+	header.insert(header.end(), { 16, 0, 0, 0, 0 });	//16 bit grey, deflate, standard filters, not interlaced
+
+	std::vector<uint8_t> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	AppendChunk(&png, "IHDR", header);
+	AppendChunk(&png, "IDAT", compressed);
+	AppendChunk(&png, "IEND", {});
+	return WriteBytes(path, png);
+}
+
+static void AppendLittleEndian(std::vector<uint8_t>* out, uint64_t value, int bytes) {
+	for (int i = 0; i < bytes; i++) { out->push_back(uint8_t(value >> (8 * i))); }
+}
+
+static void AppendAttribute(std::vector<uint8_t>* exr, const char* name, const char* type, const std::vector<uint8_t>& value) {
+	exr->insert(exr->end(), name, name + strlen(name) + 1);
+	exr->insert(exr->end(), type, type + strlen(type) + 1);
+	AppendLittleEndian(exr, value.size(), 4);
+	exr->insert(exr->end(), value.begin(), value.end());
+}
+
+bool WriteEXR(const std::string& path, int width, int height, const float* luminance) {
+	if (width <= 0 || height <= 0) { return false; }
+	auto floatBits = [](float f) { uint32_t bits; memcpy(&bits, &f, 4); return uint64_t(bits); };
+	std::vector<uint8_t> exr;
+	AppendLittleEndian(&exr, 20000630, 4);	//magic
+	AppendLittleEndian(&exr, 2, 4);			//version 2, single part scanline file
+
+	std::vector<uint8_t> value = { 'Y', 0 };	//one channel: Y, 32 bit float, x and y sampling of 1
+	AppendLittleEndian(&value, 2, 4);
+	AppendLittleEndian(&value, 0, 4);
+	AppendLittleEndian(&value, 1, 4);
+	AppendLittleEndian(&value, 1, 4);
+	value.push_back(0);
+	AppendAttribute(&exr, "channels", "chlist", value);
+	AppendAttribute(&exr, "compression", "compression", { 0 });
+	value.clear();
+	for (int coordinate : { 0, 0, width - 1, height - 1 }) { AppendLittleEndian(&value, uint32_t(coordinate), 4); }
+	AppendAttribute(&exr, "dataWindow", "box2i", value);
+	AppendAttribute(&exr, "displayWindow", "box2i", value);
+	AppendAttribute(&exr, "lineOrder", "lineOrder", { 0 });	//increasing y
+	value.clear();
+	AppendLittleEndian(&value, floatBits(1.0f), 4);
+	AppendAttribute(&exr, "pixelAspectRatio", "float", value);
+	AppendAttribute(&exr, "screenWindowWidth", "float", value);
+	value.clear();
+	AppendLittleEndian(&value, floatBits(0.0f), 4);
+	AppendLittleEndian(&value, floatBits(0.0f), 4);
+	AppendAttribute(&exr, "screenWindowCenter", "v2f", value);
+	exr.push_back(0);	//end of header
+
+	size_t lineBytes = size_t(width) * 4;
+	uint64_t offset = exr.size() + size_t(height) * 8;	//uncompressed blocks are one scanline each, and the offset table comes first
+	for (int y = 0; y < height; y++, offset += 8 + lineBytes) { AppendLittleEndian(&exr, offset, 8); }
+	for (int y = 0; y < height; y++) {
+		AppendLittleEndian(&exr, uint32_t(y), 4);
+		AppendLittleEndian(&exr, lineBytes, 4);
+		for (int x = 0; x < width; x++) { AppendLittleEndian(&exr, floatBits(luminance[size_t(y) * width + x]), 4); }
+	}
+	return WriteBytes(path, exr);
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct Image {	//single channel picture, like the target the lens is meant to reproduce
+	int width = 0;
+	int height = 0;
+	std::vector<float> pixels;	//width*height, row major with the top row first, 0 is black and 1 is white
+};
+
+bool LoadPNG(const std::string& path, Image* image);	//any non-interlaced png, colour is reduced to luminance and alpha composites onto black, returns false if it can't be read
+bool WritePNG(const std::string& path, int width, int height, const uint16_t* grey);	//16 bit greyscale, width*height values, top row first
+bool WriteEXR(const std::string& path, int width, int height, const float* luminance);	//single float Y channel, uncompressed, for keeping the raw irradiance
@@ -0,0 +1,123 @@
+#include "irradiance.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "statistics.h"
+#include "threadpool.h"
+
+void Irradiance::Resize(int newWidth, int newHeight) {
+	width = newWidth;
+	height = newHeight;
+	pixels.assign(size_t(width) * size_t(height), 0.0f);
+	for (std::vector<uint32_t>& partial : partials) { partial.assign(pixels.size(), 0); }
+}
+
+template<typename Scalar>
+void AccumulateIrradiance(const BasicPointBuffer<Scalar>& intersections, Irradiance* irradiance, bool add) {
+	ScopedTimer timer(Stage::Accumulate);
+	const size_t minRaysPerTask = size_t(1) << 16;	//below this a private histogram costs more to clear and merge than it saves
+	ThreadPool& pool = GlobalThreadPool();
+	size_t numRays = intersections.size();
+	size_t numTasks = std::max<size_t>(1, std::min<size_t>(pool.NumThreads(), numRays / minRaysPerTask));
+	size_t numPixels = irradiance->pixels.size();
+	while (irradiance->partials.size() < numTasks) { irradiance->partials.emplace_back(numPixels, 0); }
+
+	Scalar scaleX = Scalar(irradiance->width) / 256, scaleY = Scalar(irradiance->height) / 256;	//same scaling the point drawing used to do
+	Scalar width = Scalar(irradiance->width), height = Scalar(irradiance->height);
+	pool.ParallelFor(numTasks, [&](size_t task) {	//every task splats a contiguous range of rays into its own histogram, so there are no atomics or shared cache lines
+		uint32_t* histogram = irradiance->partials[task].data();
+		std::fill(histogram, histogram + numPixels, 0);
+		size_t begin = numRays * task / numTasks, end = numRays * (task + 1) / numTasks;
+		size_t offScreen = 0;
+		for (size_t i = begin; i < end; i++) {
+			Scalar x = intersections.x[i] * scaleX, y = intersections.y[i] * scaleY;
+			if (!(x >= 0 && x < width && y >= 0 && y < height)) { offScreen++; continue; }	//written this way round so NaNs get dropped too
+			histogram[size_t(y) * size_t(irradiance->width) + size_t(x)]++;
+		}
+		CountSplatted(end - begin, offScreen);
+	});
+
+	const size_t pixelsPerMergeTask = size_t(1) << 14;
+	pool.ParallelForRange(numPixels, pixelsPerMergeTask, [&](size_t begin, size_t end) {	//merge the private histograms a block of pixels at a time, the counts only become floats once they're summed
+		float* total = irradiance->pixels.data();
+		for (size_t i = begin; i < end; i++) {
+			uint64_t count = 0;
+			for (size_t task = 0; task < numTasks; task++) { count += irradiance->partials[task][i]; }
+			total[i] = (add ? total[i] : 0.0f) + float(count);
+		}
+	});
+}
+
+static float AverageLitPixel(const Irradiance& irradiance) {	//tone mapping is relative to this, so the image doesn't depend on the ray count
+	double sum = 0;
+	size_t litPixels = 0;
+	for (float value : irradiance.pixels) {
+		sum += value;
+		litPixels += value > 0;
+	}
+	return litPixels > 0 ? float(sum / double(litPixels)) : 1.0f;
+}
+
+static float ToneCurve(float value, float averageLit) {	//0 to 1
+	float relative = value / averageLit;
+	return std::sqrt(relative / (1.0f + relative));	//reinhard curve so the hot spots roll off instead of clipping, then a rough gamma so dim areas stay visible
+}
+
+void ToneMap(const Irradiance& irradiance, uint32_t* argb, int pitch) {
+	ScopedTimer timer(Stage::ToneMap);
+	float averageLit = AverageLitPixel(irradiance);
+	GlobalThreadPool().ParallelFor(size_t(irradiance.height), [&](size_t row) {
+		const float* in = irradiance.pixels.data() + row * size_t(irradiance.width);
+		uint32_t* out = argb + row * size_t(pitch);
+		for (int x = 0; x < irradiance.width; x++) {
+			uint32_t grey = uint32_t(ToneCurve(in[x], averageLit) * 255.0f + 0.5f);
+			out[x] = 0xFF000000u | (grey << 16) | (grey << 8) | grey;
+		}
+	});
+}
+
+void ToneMap(const Irradiance& irradiance, uint16_t* grey) {
+	ScopedTimer timer(Stage::ToneMap);
+	float averageLit = AverageLitPixel(irradiance);
+	GlobalThreadPool().ParallelFor(size_t(irradiance.height), [&](size_t row) {
+		const float* in = irradiance.pixels.data() + row * size_t(irradiance.width);
+		uint16_t* out = grey + row * size_t(irradiance.width);
+		for (int x = 0; x < irradiance.width; x++) { out[x] = uint16_t(ToneCurve(in[x], averageLit) * 65535.0f + 0.5f); }
+	});
+}
+
+void ToneMap(std::span<const Irradiance> bands, std::span<const ChannelWeights> weights, uint32_t* argb, int pitch) {
+	if (bands.empty()) { return; }
+	ScopedTimer timer(Stage::ToneMap);
+	int width = bands[0].width, height = bands[0].height;
+	size_t numPixels = bands[0].pixels.size();
+	double sum = 0;	//average lit pixel of the mean of the three channels, which sums the bands since each channel's weights add up to 1 over them
+	size_t litPixels = 0;
+	for (size_t i = 0; i < numPixels; i++) {
+		float total = 0;
+		for (size_t band = 0; band < bands.size(); band++) { total += bands[band].pixels[i] * (weights[band].red + weights[band].green + weights[band].blue) / 3; }
+		sum += total;
+		litPixels += total > 0;
+	}
+	float averageLit = litPixels > 0 ? float(sum / double(litPixels)) : 1.0f;
+
+	GlobalThreadPool().ParallelFor(size_t(height), [&](size_t row) {
+		uint32_t* out = argb + row * size_t(pitch);
+		for (int x = 0; x < width; x++) {
+			size_t i = row * size_t(width) + size_t(x);
+			float red = 0, green = 0, blue = 0;
+			for (size_t band = 0; band < bands.size(); band++) {
+				float value = bands[band].pixels[i];
+				red += value * weights[band].red;
+				green += value * weights[band].green;
+				blue += value * weights[band].blue;
+			}
+			uint32_t r = uint32_t(ToneCurve(red, averageLit) * 255.0f + 0.5f), g = uint32_t(ToneCurve(green, averageLit) * 255.0f + 0.5f), b = uint32_t(ToneCurve(blue, averageLit) * 255.0f + 0.5f);
+			out[x] = 0xFF000000u | (r << 16) | (g << 8) | b;
+		}
+	});
+}
+
+template void AccumulateIrradiance(const BasicPointBuffer<float>&, Irradiance*, bool);
+template void AccumulateIrradiance(const BasicPointBuffer<double>&, Irradiance*, bool);
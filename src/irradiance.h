@@ -0,0 +1,27 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+#include "raybuffer.h"
+
+struct Irradiance {	//how many rays landed in each pixel of the image, so overlapping rays show up brighter instead of all looking the same
+	int width = 0;
+	int height = 0;
+	std::vector<float> pixels;					//width*height, row major
+	std::vector<std::vector<uint32_t>> partials;	//one private histogram per parallel task, kept between calls so they're only allocated once, counted in integers since a float stops going up at 2^24
+
+	void Resize(int newWidth, int newHeight);
+};
+
+template<typename Scalar>
+void AccumulateIrradiance(const BasicPointBuffer<Scalar>& intersections, Irradiance* irradiance, bool add = false);	//intersections are in 256x256 target image coordinates and get scaled to the irradiance size, anything that lands outside is dropped
+//with add the rays go on top of what's already there instead of replacing it, so an image can be built up a batch of rays at a time
+
+void ToneMap(const Irradiance& irradiance, uint32_t* argb, int pitch);	//writes opaque grey ARGB8888 pixels, pitch is in pixels, brightness is relative to the average lit pixel so the image doesn't depend on the ray count
+void ToneMap(const Irradiance& irradiance, uint16_t* grey);	//same curve at 16 bits for writing out, width*height values with no row padding
+
+struct ChannelWeights {	//how much one histogram adds to each displayed colour
+	float red, green, blue;
+};
+
+void ToneMap(std::span<const Irradiance> bands, std::span<const ChannelWeights> weights, uint32_t* argb, int pitch);	//colour version, the bands are mixed into rgb first and the same curve is applied to each channel, bands all have to be the same size
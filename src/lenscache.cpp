@@ -0,0 +1,206 @@
+#include "lenscache.h"
+
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+
+#include "threadpool.h"
+
+static const uint64_t cacheAlignment = 64;
+
+static uint64_t AlignUp(uint64_t value) { return (value + cacheAlignment - 1) / cacheAlignment * cacheAlignment; }
+
+static uint64_t Mix(uint64_t h) {	//murmur3 finalizer, spreads every input bit over the whole word
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static uint64_t HashBlock(const char* data, size_t size, uint64_t seed) {	//word at a time multiply-rotate hash, not cryptographic, just enough to notice that the .obj changed
+	const uint64_t prime = 0x9e3779b97f4a7c15ULL;
+	uint64_t h = seed ^ (size * prime);
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		h = ((h ^ word) * prime);
+		h = (h << 31) | (h >> 33);
+	}
+	uint64_t tail = 0;
+	if (i < size) { memcpy(&tail, data + i, size - i); }
+	return Mix(h ^ tail);
+}
+
+uint64_t HashFile(const MappedFile& file) {
+	const size_t blockSize = size_t(1) << 20;
+	size_t numBlocks = (file.size + blockSize - 1) / blockSize;
+	std::vector<uint64_t> blockHashes(numBlocks);
+	GlobalThreadPool().ParallelFor(numBlocks, [&](size_t i) {
+		size_t begin = i * blockSize;
+		blockHashes[i] = HashBlock(file.data + begin, std::min(blockSize, file.size - begin), i);
+	});
+	return HashBlock(reinterpret_cast<const char*>(blockHashes.data()), blockHashes.size() * sizeof(uint64_t), file.size);
+}
+
+static int64_t ModificationTime(const std::string& path) {	//0 if it can't be read, which just forces a hash comparison
+	std::error_code error;
+	std::filesystem::file_time_type time = std::filesystem::last_write_time(path, error);
+	return error ? 0 : int64_t(time.time_since_epoch().count());
+}
+
+std::string LensCachePath(const std::string& objFilePath, VertexOrder order, bool quantized) { return objFilePath + (order == VertexOrder::Hilbert ? ".hilbert" : "") + (quantized ? ".q" : "") + ".lensbin"; }
+
+static bool FitsIn(uint64_t fileSize, uint64_t offset, uint64_t count, uint64_t elementSize) {	//whether count elements at offset lie inside the file, divides rather than multiplies so a corrupt count can't wrap past the check
+	return offset % cacheAlignment == 0 && offset <= fileSize && (elementSize == 0 || count <= (fileSize - offset) / elementSize);
+}
+
+static bool TrianglesInRange(std::span<const Triangle> triangles, uint64_t numVertices, uint64_t numNormals) {	//the supersampling indexes straight into the arrays with these, so a damaged cache has to be caught here
+	const size_t trianglesPerTask = size_t(1) << 16;
+	std::atomic<bool> inRange = true;
+	GlobalThreadPool().ParallelForRange(triangles.size(), trianglesPerTask, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			for (int corner = 0; corner < 3; corner++) {
+				if (triangles[i].vertices[corner] >= numVertices || triangles[i].normals[corner] >= numNormals) { inRange = false; return; }
+			}
+		}
+	});
+	return inRange;
+}
+
+bool OpenLensCache(const std::string& cachePath, const std::string& objFilePath, LensCache* cache) {
+	if (!cache->file.Open(cachePath) || cache->file.size < sizeof(LensCacheHeader)) { return false; }
+
+	LensCacheHeader header;
+	memcpy(&header, cache->file.data, sizeof(header));
+	if (memcmp(header.magic, lensCacheMagic, sizeof(lensCacheMagic)) != 0 || header.version != lensCacheVersion) { return false; }
+
+	uint64_t fileSize = cache->file.size;
+	bool quantized = (header.flags & lensCacheQuantized) != 0;
+	if (quantized && header.numNormals != header.numVertices) { return false; }	//only ever written for one normal per vertex
+	if (!FitsIn(fileSize, header.triangleOffset, header.numTriangles, sizeof(Triangle))) { return false; }	//truncated or corrupt
+	uint64_t componentStride = 0;
+	if (quantized) {
+		if (!FitsIn(fileSize, header.vertexOffset, header.numVertices, sizeof(uint16_t))) { return false; }	//bounds the count before AlignUp can wrap it
+		componentStride = AlignUp(header.numVertices * sizeof(uint16_t));
+		if (!FitsIn(fileSize, header.vertexOffset, 3, componentStride) || !FitsIn(fileSize, header.normalOffset, 2, componentStride) ||
+			!FitsIn(fileSize, header.quantizationOffset, 1, sizeof(QuantizedFrame))) { return false; }
+	} else if (!FitsIn(fileSize, header.vertexOffset, header.numVertices, sizeof(Eigen::Vector3d)) || !FitsIn(fileSize, header.normalOffset, header.numNormals, sizeof(Eigen::Vector3d))) { return false; }
+
+	std::error_code error;
+	uint64_t sourceSize = std::filesystem::file_size(objFilePath, error);
+	if (error || sourceSize != header.sourceSize) { return false; }
+	if (ModificationTime(objFilePath) != header.sourceModified) {	//same size but touched since, only rebuild if the contents actually changed
+		MappedFile source;
+		if (!source.Open(objFilePath) || HashFile(source) != header.sourceHash) { return false; }
+	}
+
+	const Triangle* triangles = reinterpret_cast<const Triangle*>(cache->file.data + header.triangleOffset);
+	if (!TrianglesInRange(std::span<const Triangle>(triangles, size_t(header.numTriangles)), header.numVertices, header.numNormals)) { return false; }
+
+	cache->quantized = quantized;
+	if (quantized) {
+		cache->vertices = cache->normals = nullptr;
+		for (int c = 0; c < 5; c++) {
+			uint64_t offset = (c < 3 ? header.vertexOffset + c * componentStride : header.normalOffset + (c - 3) * componentStride);
+			cache->quantizedArrays.components[c] = std::span<const uint16_t>(reinterpret_cast<const uint16_t*>(cache->file.data + offset), size_t(header.numVertices));
+		}
+		memcpy(&cache->quantizedArrays.frame, cache->file.data + header.quantizationOffset, sizeof(QuantizedFrame));
+	} else {
+		cache->vertices = reinterpret_cast<const Eigen::Vector3d*>(cache->file.data + header.vertexOffset);
+		cache->normals = reinterpret_cast<const Eigen::Vector3d*>(cache->file.data + header.normalOffset);
+	}
+	cache->numVertices = size_t(header.numVertices);
+	cache->numNormals = size_t(header.numNormals);
+	cache->triangles = triangles;
+	cache->numTriangles = size_t(header.numTriangles);
+	cache->sourceHash = header.sourceHash;
+	cache->order = VertexOrder(header.flags & 1);
+	return true;
+}
+
+struct CachePiece {	//an array to write at offset, the gaps between pieces get zero padded
+	uint64_t offset;
+	const void* data;
+	uint64_t size;
+};
+
+static bool WriteCacheFile(const std::string& cachePath, const std::string& objFilePath, LensCacheHeader header, std::span<const CachePiece> pieces) {	//fills in the magic and the source fields, pieces in increasing offset order
+	MappedFile source;
+	if (!source.Open(objFilePath)) { return false; }
+	memcpy(header.magic, lensCacheMagic, sizeof(lensCacheMagic));
+	header.version = lensCacheVersion;
+	header.sourceSize = source.size;
+	header.sourceModified = ModificationTime(objFilePath);
+	header.sourceHash = HashFile(source);
+
+	std::string tempPath = cachePath + ".tmp";	//write next to the real file and rename it into place, so another run never maps a half written cache
+	bool written = false;
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) { return false; }
+		const char padding[lensCacheHeaderSize] = {};
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		uint64_t position = sizeof(header);
+		for (const CachePiece& piece : pieces) {
+			file.write(padding, std::streamsize(piece.offset - position));
+			file.write(reinterpret_cast<const char*>(piece.data), std::streamsize(piece.size));
+			position = piece.offset + piece.size;
+		}
+		written = bool(file);
+	}
+
+	std::error_code error;
+	if (!written) { std::filesystem::remove(tempPath, error); return false; }
+	std::filesystem::rename(tempPath, cachePath, error);
+	if (error) { std::filesystem::remove(tempPath, error); return false; }
+	return true;
+}
+
+bool WriteLensCache(const std::string& cachePath, const std::string& objFilePath, std::span<const Eigen::Vector3d> vertices, std::span<const Eigen::Vector3d> normals, std::span<const Triangle> triangles, VertexOrder order) {
+	LensCacheHeader header = {};
+	header.flags = uint32_t(order);
+	header.numVertices = vertices.size();
+	header.numNormals = normals.size();
+	header.vertexOffset = lensCacheHeaderSize;
+	header.normalOffset = AlignUp(header.vertexOffset + vertices.size() * sizeof(Eigen::Vector3d));
+	header.numTriangles = triangles.size();
+	header.triangleOffset = AlignUp(header.normalOffset + normals.size() * sizeof(Eigen::Vector3d));
+	CachePiece pieces[] = {
+		{header.vertexOffset, vertices.data(), vertices.size() * sizeof(Eigen::Vector3d)},
+		{header.normalOffset, normals.data(), normals.size() * sizeof(Eigen::Vector3d)},
+		{header.triangleOffset, triangles.data(), triangles.size() * sizeof(Triangle)},
+	};
+	return WriteCacheFile(cachePath, objFilePath, header, pieces);
+}
+
+bool WriteQuantizedLensCache(const std::string& cachePath, const std::string& objFilePath, const QuantizedArrays& lens, std::span<const Triangle> triangles, VertexOrder order) {
+	size_t numRays = lens.components[0].size();
+	for (const std::span<const uint16_t>& component : lens.components) {
+		if (component.size() != numRays) { return false; }
+	}
+	uint64_t componentStride = AlignUp(numRays * sizeof(uint16_t));
+	LensCacheHeader header = {};
+	header.flags = uint32_t(order) | lensCacheQuantized;
+	header.numVertices = numRays;
+	header.numNormals = numRays;
+	header.vertexOffset = lensCacheHeaderSize;
+	header.normalOffset = header.vertexOffset + 3 * componentStride;
+	header.numTriangles = triangles.size();
+	header.triangleOffset = header.normalOffset + 2 * componentStride;
+	header.quantizationOffset = AlignUp(header.triangleOffset + triangles.size() * sizeof(Triangle));
+	CachePiece pieces[] = {
+		{header.vertexOffset, lens.components[0].data(), numRays * sizeof(uint16_t)},
+		{header.vertexOffset + componentStride, lens.components[1].data(), numRays * sizeof(uint16_t)},
+		{header.vertexOffset + 2 * componentStride, lens.components[2].data(), numRays * sizeof(uint16_t)},
+		{header.normalOffset, lens.components[3].data(), numRays * sizeof(uint16_t)},
+		{header.normalOffset + componentStride, lens.components[4].data(), numRays * sizeof(uint16_t)},
+		{header.triangleOffset, triangles.data(), triangles.size() * sizeof(Triangle)},
+		{header.quantizationOffset, &lens.frame, sizeof(QuantizedFrame)},
+	};
+	return WriteCacheFile(cachePath, objFilePath, header, pieces);
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include "Eigen/Core"
+#include "mappedfile.h"
+
+//.lensbin sidecar files hold the parsed vertices and normals of an .obj so that reopening the same lens skips the text parse entirely
+//layout, in native byte order: a LensCacheHeader padded out to 128 bytes, then numVertices Vector3d's, numNormals Vector3d's and numTriangles Triangles, each array starting on a 64 byte boundary
+//a quantized cache has the five uint16_t arrays of QuantizedArrays in place of the Vector3d's, each on its own 64 byte boundary, vertex x, y, z at vertexOffset and normal u, v at normalOffset, then a QuantizedFrame
+
+const char lensCacheMagic[8] = { 'L', 'E', 'N', 'S', 'B', 'I', 'N', '\0' };
+const uint32_t lensCacheVersion = 3;		//bump whenever the layout changes, older files are then treated as stale and rebuilt
+const size_t lensCacheHeaderSize = 128;	//room for the header to grow without moving the arrays
+
+struct Triangle {	//one face of the lens, as zero based indices into the vertices and normals, polygons get split into fans of these
+	uint32_t vertices[3];
+	uint32_t normals[3];
+};
+
+enum class VertexOrder : uint32_t {	//what order the arrays in a cache are in, kept in the header's flags
+	File = 0,		//as the .obj lists them
+	Hilbert = 1,	//along a Hilbert curve over (x, y), see reorder.h
+};
+
+const uint32_t lensCacheQuantized = 2;	//flag for a cache holding the quantized form of the lens instead of the Vector3d's
+
+struct LensCacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;				//the VertexOrder in bit 0 and lensCacheQuantized, the other bits are reserved so later layouts can be told apart without moving the fields below
+	uint64_t numVertices;
+	uint64_t numNormals;
+	uint64_t vertexOffset;		//byte offsets from the start of the file
+	uint64_t normalOffset;
+	uint64_t numTriangles;
+	uint64_t triangleOffset;
+	uint64_t sourceSize;		//size, modification time and content hash of the .obj the cache was built from
+	int64_t sourceModified;
+	uint64_t sourceHash;
+	uint64_t quantizationOffset;	//where the QuantizedFrame is in a quantized cache, 0 otherwise
+};
+static_assert(sizeof(LensCacheHeader) <= lensCacheHeaderSize, "lens cache header must fit in the space reserved for it");
+static_assert(sizeof(Eigen::Vector3d) == 3 * sizeof(double), "lens cache arrays are read straight into Vector3d's");
+
+struct QuantizedFrame {	//how a quantized lens maps back, see quantize.h
+	double origin[3];			//vertex coordinate c is origin[c] + q*scale[c]
+	double scale[3];
+	double maxPositionError;	//the furthest quantizing moved any vertex, in lens units
+	double maxNormalError;		//the furthest it turned any normal, in radians
+};
+
+struct QuantizedArrays {	//a quantized lens as it's laid out in a cache
+	std::span<const uint16_t> components[5];	//vertex x, y and z, then the normals' octahedral u and v, all the same length
+	QuantizedFrame frame;
+};
+
+struct LensCache {	//a mapped cache file, vertices and normals point straight into the mapping and stay valid for as long as this does
+	MappedFile file;
+	const Eigen::Vector3d* vertices = nullptr;
+	const Eigen::Vector3d* normals = nullptr;
+	size_t numVertices = 0;
+	size_t numNormals = 0;
+	const Triangle* triangles = nullptr;
+	size_t numTriangles = 0;
+	uint64_t sourceHash = 0;	//the .obj's content hash from the header
+	VertexOrder order = VertexOrder::File;
+	bool quantized = false;		//if so vertices and normals are null and the lens is in quantizedArrays instead
+	QuantizedArrays quantizedArrays;
+};
+
+std::string LensCachePath(const std::string& objFilePath, VertexOrder order = VertexOrder::File, bool quantized = false);	//where the sidecar for an .obj lives, each order and the quantized form get their own so switching between them doesn't throw the others away
+uint64_t HashFile(const MappedFile& file);	//fast content hash, computed in parallel over fixed size blocks so the result doesn't depend on the thread count
+
+bool OpenLensCache(const std::string& cachePath, const std::string& objFilePath, LensCache* cache);	//returns false if the cache is missing, from another version, damaged, or was built from a different .obj, damaged includes any triangle corner past the end of its array
+bool WriteLensCache(const std::string& cachePath, const std::string& objFilePath, std::span<const Eigen::Vector3d> vertices, std::span<const Eigen::Vector3d> normals, std::span<const Triangle> triangles, VertexOrder order = VertexOrder::File);
+bool WriteQuantizedLensCache(const std::string& cachePath, const std::string& objFilePath, const QuantizedArrays& lens, std::span<const Triangle> triangles, VertexOrder order = VertexOrder::File);	//meant for the quantized sidecar, the full cache is left alone
@@ -0,0 +1,26 @@
+#pragma once
+#include <atomic>
+
+//hands the latest value from one thread to another without either of them ever waiting, older values that were never picked up just get overwritten
+//three slots, so the writer always has one to fill, the reader always has one to look at and the one in the middle holds the newest finished value
+
+template<typename T>
+class Mailbox {	//one writer thread and one reader thread
+public:
+	T& Back() { return slots[back]; }	//the writer's slot, it may still hold an old value so fill in all of it, the allocations get reused
+	void Publish() { back = middle.exchange(back | fresh, std::memory_order_acq_rel) & index; }	//hands Back() over and takes the middle slot to write into next
+
+	bool Take() {	//the reader moves on to the newest published value, false and Front() unchanged if there's nothing new
+		if ((middle.load(std::memory_order_relaxed) & fresh) == 0) { return false; }
+		front = middle.exchange(front, std::memory_order_acq_rel) & index;
+		return true;
+	}
+	const T& Front() const { return slots[front]; }	//the reader's slot, only valid after Take has returned true once
+
+private:
+	static constexpr unsigned index = 3, fresh = 4;	//the middle slot's index in the low bits, plus whether it's been published since the reader last took
+	T slots[3];
+	std::atomic<unsigned> middle{1};
+	unsigned back = 0;	//only touched by the writer
+	unsigned front = 2;	//only touched by the reader
+};
@@ -1,78 +1,378 @@
+#include <algorithm>
+#include <filesystem>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <sstream>
 #include <string>
 #include <vector>
 
 #include "Eigen/Core"
 #include "SDL.h"
+#include "cluster.h"
+#include "computethread.h"
+#include "irradiance.h"
+#include "image.h"
 #include "refract.h"
+#include "similarity.h"
+#include "statistics.h"
+#include "sweep.h"
 
-const double eta = 1.457;	//refractive index that was used to generate the lens
+const double defaultEta = 1.457;	//refractive index that was used to generate the lens
+const double etaStep = 0.01;		//how far E/D nudge the index
 int windowWidth = 256;		//dimensions of the display window
 int windowHeight = 256;
 
-void DrawIntersections(SDL_Renderer* renderer, std::vector<Eigen::Vector2d> intersections) {	//display the intersections onto the window
-	int numPoints = int(intersections.size());
-	float scaleX = windowWidth / 256.0f;		//initially, we draw to a 256x256 window, but we want to be able to account for changing the window size
-	float scaleY = windowHeight / 256.0f;
+void UploadFrame(SDL_Renderer* renderer, SDL_Texture** texture, const Frame& frame) {	//copies a finished frame into the texture the window gets painted from, remade whenever the frames change size
+	int textureWidth = 0, textureHeight = 0;
+	if (*texture != nullptr) { SDL_QueryTexture(*texture, nullptr, nullptr, &textureWidth, &textureHeight); }
+	if (*texture == nullptr || textureWidth != frame.width || textureHeight != frame.height) {
+		if (*texture != nullptr) { SDL_DestroyTexture(*texture); }
+		*texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, frame.width, frame.height);
+	}
+	SDL_UpdateTexture(*texture, nullptr, frame.argb.data(), frame.width * int(sizeof(uint32_t)));	//one upload per frame rather than a driver call per ray
+}
 
-	SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0xFF);	//clear the screen with black
-	SDL_RenderClear(renderer);
+bool WriteIrradiance(const std::string& path, const Irradiance& irradiance) {	//.exr keeps the raw ray counts, anything else gets the viewer's tone curve as a 16 bit png
+	if (std::filesystem::path(path).extension() == ".exr") { return WriteEXR(path, irradiance.width, irradiance.height, irradiance.pixels.data()); }
+	std::vector<uint16_t> grey(irradiance.pixels.size());
+	ToneMap(irradiance, grey.data());
+	return WritePNG(path, irradiance.width, irradiance.height, grey.data());
+}
 
-	SDL_SetRenderDrawColor(renderer, 0xFF, 0xFF, 0xFF, 0xFF);	//then draw the intersections
-	for (int i = 0; i < numPoints; i++) {	
-		SDL_RenderDrawPointF(renderer, intersections[i].x() * scaleX, intersections[i].y() * scaleY);	//scaling up the image to match the window size
-	}
-	SDL_RenderPresent(renderer);
+std::string NumberedPath(const std::string& path, size_t index) {	//out.png becomes out_3.png, for writing one image per swept distance
+	std::filesystem::path numbered(path);
+	numbered.replace_filename(numbered.stem().string() + "_" + std::to_string(index) + numbered.extension().string());
+	return numbered.string();
+}
 
+void PresentCaustics(SDL_Renderer* renderer, SDL_Texture* texture) {	//put the cached caustics texture on screen, stretched to whatever size the window is now
+	SDL_RenderClear(renderer);
+	SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+	SDL_RenderPresent(renderer);
 }
 
 int main(int argc, char** argv) {
-	
-	std::vector<Eigen::Vector3d> vertices;			//points, these are the positions where we refract rays through the lens
-	std::vector<Eigen::Vector3d> normals;			//normal vectors, these are used to calculate the refraction through the above points
-	std::vector<Eigen::Vector3d> refracteds;		//refracted ray vectors, these are the normalized directions that light leaves from each of the points
-	std::vector<Eigen::Vector2d> intersections;		//x,y positions on the receiver plane where light intersects, scaled up to match the 256x256 of the target image
+	if (argc >= 3 && std::string(argv[1]) == "--serve") {	//--serve <port> makes this a worker for --nodes, the jobs say which lens to read
+		std::string bindAddress = defaultServeAddress;	//--bind <address> listens there instead of on loopback, only for networks where everyone who can reach the port is trusted
+		for (int i = 3; i < argc; i++) {
+			if (std::string(argv[i]) == "--bind" && i + 1 < argc) { bindAddress = argv[++i]; }
+			else { std::cout << "Unknown option " << argv[i] << "\n"; }
+		}
+		return ServeSweeps(bindAddress, std::stoi(argv[2])) ? 0 : 1;
+	}
+
+	RayBuffer vertices;								//points, these are the positions where we refract rays through the lens
+	RayBuffer normals;								//normal vectors, these are used to calculate the refraction through the above points
+	RayBuffer refracteds;							//refracted ray vectors, these are the normalized directions that light leaves from each of the points
+	AffineIntersections affine;						//per ray offset and slope of the intersection as a function of receiver distance, so moving the plane is one multiply-add per ray
+	std::vector<Triangle> triangles;				//faces of the lens, for supersampling
 
-	ParseOBJ(argv[1], &vertices, &normals);			//first command line argument is the path to the obj file
 	double receieverPlane = std::stod(argv[2]);		//second argument is the initial distance between the lens and the receiver plane/the wall, in the z direction, wall is parallel to x-y plane
+	double eta = defaultEta;						//--eta <n> sets the refractive index of the lens, E/D change it while running
+	Light light;									//--light-direction <x> <y> <z> for off-axis collimated light, --point-light <x> <y> <z> for a point source, otherwise straight down z
+	double slabThickness = -1;						//--slab <thickness> traces the lens as a slab with a flat entry face that far below it, instead of refracting only at the obj surface
+	bool validatePrecision = false;					//--validate-precision reports how far single precision would move the rays before opening the window
+	bool useGPU = false;							//--gpu runs the solver on the graphics card, for builds with CAUSTICS_GPU
+	int numBands = 0;								//--bands <n> renders in colour with n wavelengths, each refracted at its own index
+	std::string glassModel = "cauchy";				//--glass cauchy|sellmeier picks how the index changes with wavelength
+	int samplesPerTriangle = 0;						//--supersample <k> traces k jittered rays across each face of the mesh instead of one per vertex, for smoother caustics from coarse lenses
+	std::string outputPath;							//--headless <image.png|image.exr> writes the irradiance out instead of opening a window, SDL never gets initialised
+	int sweepSteps = 0;								//--sweep <start> <end> <steps> scores that many receiver distances without opening a window
+	double sweepStart = 0, sweepEnd = 0;
+	std::string targetPath;							//--target <png> scores the sweep against the image the lens was made for and picks the distance that matches it best
+	std::string statisticsPath;						//--stats <file.json> writes the stage timings and ray counts there on the way out
+	VertexOrder vertexOrder = VertexOrder::File;	//--hilbert-order keeps the lens sorted along a Hilbert curve so neighbouring rays sit together in memory, the sorted copy is cached like the parse
+	bool progressive = true;						//--no-progressive always draws every ray at once, otherwise big lenses show a 1/64 then a 1/16 preview first and moving the plane cancels whatever is left
+	size_t streamBlockRays = 0;						//--stream <rays per block> reads, refracts and splats the lens that many rays at a time in batch mode, for lenses that don't fit in memory
+	bool quantize = false;							//--quantize keeps the lens as 16 bit vertices and octahedral normals, 10 bytes a ray, decoded in the refraction kernel, the quantized copy is cached like the parse
+	std::vector<std::string> workers;				//--nodes <host:port,...> splits a batch run across workers started with --serve, each streams a shard of the lens and only the histograms come back
+	int nodeTimeoutSeconds = defaultNodeTimeoutSeconds;	//--node-timeout <seconds> is how long a node of a --nodes run waits on one that's gone quiet
+	bool binTiles = false;							//--bin-tiles sorts the rays by screen tile before splatting, which pays off once the window is too big for the histograms to stay in cache
+	for (int i = 3; i < argc; i++) {
+		if (std::string(argv[i]) == "--validate-precision") { validatePrecision = true; }
+		else if (std::string(argv[i]) == "--gpu") { useGPU = true; }
+		else if (std::string(argv[i]) == "--eta" && i + 1 < argc) { eta = std::stod(argv[++i]); }
+		else if (std::string(argv[i]) == "--slab" && i + 1 < argc) { slabThickness = std::max(0.0, std::stod(argv[++i])); }
+		else if ((std::string(argv[i]) == "--light-direction" || std::string(argv[i]) == "--point-light") && i + 3 < argc) {
+			Eigen::Vector3d v(std::stod(argv[i + 1]), std::stod(argv[i + 2]), std::stod(argv[i + 3]));
+			if (std::string(argv[i]) == "--point-light") { light.type = Light::Type::Point; light.position = v; }
+			else { light.type = Light::Type::Directional; light.direction = v; }
+			i += 3;
+		}
+		else if (std::string(argv[i]) == "--sweep" && i + 3 < argc) {
+			sweepStart = std::stod(argv[i + 1]);
+			sweepEnd = std::stod(argv[i + 2]);
+			sweepSteps = std::stoi(argv[i + 3]);
+			i += 3;
+		}
+		else if (std::string(argv[i]) == "--target" && i + 1 < argc) { targetPath = argv[++i]; }
+		else if (std::string(argv[i]) == "--headless" && i + 1 < argc) { outputPath = argv[++i]; }
+		else if (std::string(argv[i]) == "--stats" && i + 1 < argc) { statisticsPath = argv[++i]; }
+		else if (std::string(argv[i]) == "--bin-tiles") { binTiles = true; }
+		else if (std::string(argv[i]) == "--stream" && i + 1 < argc) { streamBlockRays = size_t(std::max(1LL, std::stoll(argv[++i]))); }
+		else if (std::string(argv[i]) == "--nodes" && i + 1 < argc) {
+			std::stringstream list(argv[++i]);
+			for (std::string worker; std::getline(list, worker, ',');) { if (!worker.empty()) { workers.push_back(worker); } }
+		}
+		else if (std::string(argv[i]) == "--node-timeout" && i + 1 < argc) { nodeTimeoutSeconds = std::max(1, std::stoi(argv[++i])); }
+		else if (std::string(argv[i]) == "--no-progressive") { progressive = false; }
+		else if (std::string(argv[i]) == "--quantize") { quantize = true; }
+		else if (std::string(argv[i]) == "--hilbert-order") { vertexOrder = VertexOrder::Hilbert; }
+		else if (std::string(argv[i]) == "--bands" && i + 1 < argc) { numBands = std::stoi(argv[++i]); }
+		else if (std::string(argv[i]) == "--glass" && i + 1 < argc) { glassModel = argv[++i]; }
+		else if (std::string(argv[i]) == "--supersample" && i + 1 < argc) { samplesPerTriangle = std::max(0, std::stoi(argv[++i])); }
+		else { std::cout << "Unknown option " << argv[i] << "\n"; }
+	}
+
+	bool batch = sweepSteps > 0 || !outputPath.empty();
+	if (numBands > 0 && batch) { std::cout << "Dispersion only renders in the viewer, --headless and --sweep write one grey image per distance, ignoring --bands\n"; numBands = 0; }	//before the checks below so nothing else gets turned off for it
+	if (streamBlockRays > 0 && !batch) { std::cout << "Streaming only works with --headless or --sweep, loading the whole lens\n"; streamBlockRays = 0; }
+	if (streamBlockRays > 0 && slabThickness >= 0) { std::cout << "The slab model needs the whole lens, loading all of it\n"; streamBlockRays = 0; }
+	if (streamBlockRays > 0 && samplesPerTriangle > 0) { std::cout << "Supersampling needs the whole lens, loading all of it\n"; streamBlockRays = 0; }
+	if (streamBlockRays > 0 && validatePrecision) { std::cout << "Precision validation needs the whole lens, skipping it while streaming\n"; }
+	if (!workers.empty() && (!batch || slabThickness >= 0 || samplesPerTriangle > 0)) { std::cout << "Only plain --headless and --sweep runs can be split across nodes, rendering here\n"; workers.clear(); }
+	bool distributed = !workers.empty();
+	if (distributed && validatePrecision && streamBlockRays == 0) { std::cout << "Precision validation needs the whole lens, skipping it for a distributed run\n"; }
+
+	if (quantize && (streamBlockRays > 0 || distributed || slabThickness >= 0 || samplesPerTriangle > 0 || numBands > 0 || useGPU)) { std::cout << "Streaming, slabs, supersampling, dispersion and the GPU need the full precision lens, ignoring --quantize\n"; quantize = false; }
+	if (quantize && validatePrecision) { std::cout << "Precision validation needs the full precision lens, skipping it\n"; }
+
+	uint64_t lensHash = 0;
+	QuantizedLens quantized;
+	if (quantize) {
+		if (LoadQuantizedLens(argv[1], &quantized, vertexOrder)) {
+			std::cout << "Quantized to 10 bytes a ray instead of " << 6 * sizeof(Real) << ", vertices within " << quantized.frame.maxPositionError << " and normals within " << quantized.frame.maxNormalError << " radians\n";
+			lensHash = quantized.hash;
+		}
+		else { std::cout << "The lens doesn't have one normal per vertex, loading it in full precision\n"; quantize = false; }
+	}
+	if (streamBlockRays == 0 && !distributed && !quantize) {
+		Lens lens;
+		LoadLens(argv[1], &lens, vertexOrder);					//first command line argument is the path to the obj file, the parsed lens is cached next to it so the next run loads instantly
+		if (validatePrecision) {
+			PrecisionReport report = ValidatePrecision(lens.vertices, lens.normals, eta, receieverPlane);
+			std::cout << "Single vs double precision: max deviation " << report.maxPixelDeviation << " pixels, " << report.raysChangedPixel << " of " << report.raysCompared << " on-screen rays change pixel\n";
+		}
+		ToRayBuffer(lens.vertices, &vertices);		//the solver works on structure of arrays copies, so the lens itself can go once they're made
+		ToRayBuffer(lens.normals, &normals);
+		if (samplesPerTriangle > 0) { triangles.assign(lens.triangles.begin(), lens.triangles.end()); }
+		lensHash = lens.hash;
+	}
+	if (samplesPerTriangle > 0 && triangles.empty()) { std::cout << "The lens has no faces to supersample, tracing one ray per vertex\n"; samplesPerTriangle = 0; }
+	if (samplesPerTriangle > 0 && slabThickness >= 0) { std::cout << "Supersampling only traces the obj surface, ignoring --slab\n"; }
+
+	if (batch) {	//batch mode, just file io and compute, every distance comes out of the same pass over the rays
+		Image target;
+		if (!targetPath.empty() && !LoadPNG(targetPath, &target)) { std::cout << "Couldn't read target image " << targetPath << "\n"; return 1; }
+		int imageWidth = target.pixels.empty() ? 256 : target.width;	//score at the target's resolution
+		int imageHeight = target.pixels.empty() ? 256 : target.height;
+
+		std::vector<double> distances = sweepSteps > 0 ? SweepDistances(sweepStart, sweepEnd, sweepSteps) : std::vector<double>{ receieverPlane };
+		double imageBytes = double(distances.size()) * imageWidth * imageHeight * sizeof(float);	//the sweep keeps every distance's image, past the histogram budget it only costs extra passes but these it has to hold
+		if (imageBytes > double(size_t(1) << 30)) { std::cout << "Keeping " << distances.size() << " " << imageWidth << "x" << imageHeight << " images takes " << int(imageBytes / (1 << 20)) << " MB, use fewer --sweep steps or a smaller target if that's too much\n"; }
+		std::vector<Irradiance> images;
+		if (distributed) {	//every node streams its own shard, so no one machine ever holds all of the lens
+			ClusterJob job;
+			job.lensPath = std::filesystem::absolute(argv[1]).string();	//the workers may not share our working directory
+			job.workers = workers;
+			if (streamBlockRays > 0) { job.raysPerBlock = streamBlockRays; }
+			job.eta = eta;
+			job.light = light;
+			job.distances = distances;
+			job.width = imageWidth;
+			job.height = imageHeight;
+			job.timeoutSeconds = nodeTimeoutSeconds;
+			if (!PlanLensShards(job.lensPath, workers.size() + 1, &job.plan)) { std::cout << "Invalid file\n"; return 1; }
+			if (!DistributedSweep(job, &images)) { return 1; }
+		}
+		else if (streamBlockRays > 0) {	//the lens is never all in memory, only one block of it and the images
+			LensStream stream;
+			if (!OpenLensStream(argv[1], &stream)) { return 1; }
+			StreamingSweep(&stream, streamBlockRays, eta, light, distances, imageWidth, imageHeight, &images);
+			if (stream.malformedLines > 0) { std::cout << "Skipped " << stream.malformedLines << " malformed vertex/normal lines\n"; }
+		}
+		else if (samplesPerTriangle > 0) { SupersampledSweep(vertices, normals, triangles, samplesPerTriangle, eta, light, distances, imageWidth, imageHeight, &images); }
+		else {
+			if (quantize) { PrepareQuantizedIntersections(quantized, eta, light, &affine); }
+			else if (slabThickness >= 0) { TraceSlab(vertices, normals, &affine, eta, light, slabThickness); }
+			else {
+				Refract(vertices, normals, &refracteds, eta, light);
+				PrepareAffineIntersections(vertices, refracteds, &affine);
+			}
+			AffineIntersections active;
+			CompactIntersections(affine, *std::min_element(distances.begin(), distances.end()), *std::max_element(distances.begin(), distances.end()), &active);	//the sweep only ever looks at this range
+			FocusSweep(active, distances, imageWidth, imageHeight, &images);
+		}
+
+		size_t best = 0;
+		double bestScore = -1e300;
+		std::cout << "distance contrast sharpness" << (target.pixels.empty() ? "" : " l2 ssim emd") << "\n";
+		for (size_t k = 0; k < distances.size(); k++) {
+			SweepResult result;
+			result.distance = distances[k];
+			MeasureFocus(images[k], &result);
+			std::cout << result.distance << " " << result.contrast << " " << result.sharpness;
+			double score = result.sharpness;
+			SimilarityScore similarity;
+			if (!target.pixels.empty() && CompareToTarget(images[k], target, &similarity)) {
+				std::cout << " " << similarity.l2 << " " << similarity.ssim << " " << similarity.emd;
+				score = similarity.ssim;
+			}
+			std::cout << "\n";
+			if (score > bestScore) { best = k; bestScore = score; }
+
+			if (!outputPath.empty()) {
+				std::string path = distances.size() == 1 ? outputPath : NumberedPath(outputPath, k);
+				if (!WriteIrradiance(path, images[k])) { std::cout << "Couldn't write " << path << "\n"; return 1; }
+			}
+		}
+		if (distances.size() > 1) { std::cout << (target.pixels.empty() ? "Sharpest at " : "Best match to target at ") << distances[best] << "\n"; }
+		if (!statisticsPath.empty() && !WriteStatistics(statisticsPath)) { std::cout << "Couldn't write " << statisticsPath << "\n"; return 1; }
+		return 0;
+	}
 
-	Refract(normals, &refracteds, eta);				//find the refracted ray directions at each point
+	if (numBands > 0 && useGPU) { std::cout << "Dispersion only runs on the CPU\n"; useGPU = false; }
+	if ((light.type != Light::Type::Axial || slabThickness >= 0) && useGPU) { std::cout << "Off-axis light and slabs only run on the CPU\n"; useGPU = false; }
+	if (numBands > 0 && slabThickness >= 0) { std::cout << "Dispersion only traces the obj surface, ignoring --slab\n"; }
+	if (numBands > 0 && samplesPerTriangle > 0) { std::cout << "Dispersion traces one ray per vertex, ignoring --supersample\n"; samplesPerTriangle = 0; }
+	if (samplesPerTriangle > 0 && useGPU) { std::cout << "Supersampling only runs on the CPU\n"; useGPU = false; }
 
 	//make a window to display an image of the computed caustics
 	SDL_Init(SDL_INIT_EVERYTHING);
-	SDL_Window* window = SDL_CreateWindow("Caustics Image", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, windowWidth, windowHeight, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
-	SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-
-	CalculateIntersections(vertices, refracteds, &intersections, receieverPlane);
-	DrawIntersections(renderer, intersections);
+#ifdef CAUSTICS_GPU
+	if (useGPU) {	//has to be set up before the window is created
+		SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
+		SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+		SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+	}
+#else
+	if (useGPU) { std::cout << "Built without CAUSTICS_GPU, using the CPU\n"; useGPU = false; }
+#endif
+	SDL_Window* window = SDL_CreateWindow("Caustics Image", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, windowWidth, windowHeight, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE | (useGPU ? SDL_WINDOW_OPENGL : 0));
+	SDL_Renderer* renderer = nullptr;
+#ifdef CAUSTICS_GPU
+	SDL_GLContext glContext = nullptr;
+	GPURays* gpuRays = nullptr;		//the lens on the device, when we're using it
+	if (useGPU) {
+		glContext = SDL_GL_CreateContext(window);
+		if (glContext != nullptr) { gpuRays = CreateGPURays(vertices, normals); }
+		if (gpuRays == nullptr) {
+			std::cout << "Couldn't start the GPU backend, using the CPU\n";
+			if (glContext != nullptr) { SDL_GL_DeleteContext(glContext); }
+			useGPU = false;
+		}
+	}
+	if (useGPU) {
+		Refract(gpuRays, eta);		//find the refracted ray directions at each point, on the device
+		vertices = RayBuffer();		//the device has its own copy now, no point holding on to ours
+		normals = RayBuffer();
+	}
+#endif
+	std::unique_ptr<ComputeThread> compute;	//the CPU solver, it gets a thread of its own so a slow frame never holds up the window
+	Uint32 frameEvent = SDL_RegisterEvents(1);	//posted by the compute thread whenever it finishes a frame, to wake the event loop up
+	if (!useGPU) {
+		renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+		ComputeSettings settings;
+		settings.vertices = std::move(vertices);	//the compute thread owns the lens from here on
+		settings.normals = std::move(normals);
+		settings.quantized = std::move(quantized);
+		settings.quantizedLens = quantize;
+		settings.triangles = std::move(triangles);
+		settings.lensHash = lensHash;
+		settings.light = light;
+		settings.slabThickness = slabThickness;
+		settings.numBands = numBands;
+		settings.glassModel = glassModel;
+		settings.samplesPerTriangle = samplesPerTriangle;
+		settings.progressive = progressive;
+		settings.binTiles = binTiles;
+		compute = std::make_unique<ComputeThread>(std::move(settings), [frameEvent]() {
+			SDL_Event event = {};
+			event.type = frameEvent;
+			SDL_PushEvent(&event);	//one of the few SDL calls that's safe from another thread
+		});
+	}
+	SDL_Texture* texture = nullptr;	//the newest finished frame, made at its size by UploadFrame
 
 	bool quit = false;
+	bool etaChanged = false;	//the refracted directions are out of date too
+	bool planeMoved = true;		//the intersections are out of date and need recomputing, true to begin with so the first frame gets computed
+	bool needsPresent = true;	//the window needs repainting from the cached texture
 	SDL_Event e;
 	while (!quit) //main loop
 	{
-		while (SDL_PollEvent(&e) != 0)	//loop through events
+#ifdef CAUSTICS_GPU
+		if (useGPU && (etaChanged || planeMoved)) {	//the device work is queued from this thread, since the GL context lives here
+			ScopedTimer timer(Stage::Draw);
+			if (etaChanged) { Refract(gpuRays, eta); }
+			CalculateIntersections(gpuRays, receieverPlane, windowWidth, windowHeight);
+			needsPresent = true;
+		}
+#endif
+		if (!useGPU && (etaChanged || planeMoved)) {	//just ask, the frame shows up when it's ready and anything asked for in the meantime replaces this
+			ViewRequest view;
+			view.receiverPlane = receieverPlane;
+			view.eta = eta;
+			view.width = windowWidth;
+			view.height = windowHeight;
+			compute->Request(view);
+		}
+		etaChanged = false;
+		planeMoved = false;
+		if (!useGPU) {
+			if (const Frame* frame = compute->TakeFrame()) {
+				UploadFrame(renderer, &texture, *frame);
+				needsPresent = true;
+			}
+		}
+		if (needsPresent) {
+#ifdef CAUSTICS_GPU
+			if (useGPU) {	//the histogram never leaves the device, it gets tone mapped straight into the window
+				int drawableWidth, drawableHeight;
+				SDL_GL_GetDrawableSize(window, &drawableWidth, &drawableHeight);
+				PresentIrradiance(gpuRays, drawableWidth, drawableHeight);
+				SDL_GL_SwapWindow(window);
+			}
+#endif
+			if (!useGPU) { PresentCaustics(renderer, texture); }
+			needsPresent = false;
+		}
+
+		if (SDL_WaitEvent(&e) == 0) { continue; }	//sleep until something happens instead of spinning on SDL_PollEvent, finished frames come in as events too
+		do	//then drain everything that queued up, so a burst of key repeats turns into a single recompute
 		{
 			if (e.type == SDL_QUIT) { quit = true; }
-			else if (e.window.event == SDL_WINDOWEVENT_RESIZED) {
-				windowWidth = e.window.data1;
-				windowHeight = e.window.data2;
-				DrawIntersections(renderer, intersections);
+			else if (e.type == frameEvent) {}	//taken at the top of the loop
+			else if (e.type == SDL_WINDOWEVENT) {
+				if (e.window.event == SDL_WINDOWEVENT_RESIZED) {	//just rescale what we already have, nothing about the rays changed
+					windowWidth = e.window.data1;
+					windowHeight = e.window.data2;
+					needsPresent = true;
+				}
+				else if (e.window.event == SDL_WINDOWEVENT_EXPOSED) { needsPresent = true; }
 			}
 			else if (e.type == SDL_KEYDOWN) {
 				switch (e.key.keysym.sym) {
 				case SDLK_w:	//for fine-tuning the position of the lens
 					receieverPlane += 0.1;
-					CalculateIntersections(vertices, refracteds, &intersections, receieverPlane);
-					DrawIntersections(renderer, intersections);
+					planeMoved = true;
 					break;
 				case SDLK_s:	//for fine-tuning the position of the lens
 					receieverPlane -= 0.1;
-					CalculateIntersections(vertices, refracteds, &intersections, receieverPlane);
-					DrawIntersections(renderer, intersections);
+					planeMoved = true;
+					break;
+				case SDLK_e:	//for trying out other materials
+					eta += etaStep;
+					etaChanged = true;
+					break;
+				case SDLK_d:
+					eta -= etaStep;
+					etaChanged = true;
 					break;
 				case SDLK_q:	//for fine-tuning the position of the lens
-					std::cout << "Current distance between wall and lens: " << receieverPlane << "\n";
+					std::cout << "Current distance between wall and lens: " << receieverPlane << ", refractive index: " << eta << "\n";
+					PrintStatistics(std::cout);
 					break;
 				case SDLK_ESCAPE:
 					quit = true;
@@ -81,10 +381,20 @@ int main(int argc, char** argv) {
 					break;
 				}
 			}
-		}
-
-		
+		} while (SDL_PollEvent(&e) != 0);
 	}
 
+#ifdef CAUSTICS_GPU
+	if (useGPU) {
+		DestroyGPURays(gpuRays);
+		SDL_GL_DeleteContext(glContext);
+	}
+#endif
+	compute.reset();	//before the statistics, so they include the frame that was in flight
+	if (!statisticsPath.empty() && !WriteStatistics(statisticsPath)) { std::cout << "Couldn't write " << statisticsPath << "\n"; }
+	if (texture != nullptr) { SDL_DestroyTexture(texture); }
+	if (renderer != nullptr) { SDL_DestroyRenderer(renderer); }
+	SDL_DestroyWindow(window);
+	SDL_Quit();
 	return 0;
 }
@@ -0,0 +1,70 @@
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const std::string& path) {
+	Close();
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) { return false; }
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize)) { CloseHandle(file); return false; }
+	fileHandle = file;
+	size = size_t(fileSize.QuadPart);
+	if (size == 0) { return true; }	//windows refuses to map empty files, but there's nothing to read anyway
+
+	mappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mappingHandle == nullptr) { Close(); return false; }
+	data = static_cast<const char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+	if (data == nullptr) { Close(); return false; }
+	return true;
+}
+
+void MappedFile::Close() {
+	if (data != nullptr) { UnmapViewOfFile(data); }
+	if (mappingHandle != nullptr) { CloseHandle(mappingHandle); }
+	if (fileHandle != nullptr) { CloseHandle(fileHandle); }
+	data = nullptr;
+	mappingHandle = nullptr;
+	fileHandle = nullptr;
+	size = 0;
+}
+
+#else
+
+bool MappedFile::Open(const std::string& path) {
+	Close();
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) { return false; }
+
+	struct stat info;
+	if (fstat(fd, &info) != 0) { close(fd); return false; }
+	size = size_t(info.st_size);
+	if (size == 0) { close(fd); return true; }	//mmap refuses zero length mappings, but there's nothing to read anyway
+
+	void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);	//the mapping keeps its own reference to the file
+	if (mapping == MAP_FAILED) { size = 0; return false; }
+	madvise(mapping, size, MADV_SEQUENTIAL);	//we read front to back, let the kernel read ahead aggressively
+	data = static_cast<const char*>(mapping);
+	return true;
+}
+
+void MappedFile::Close() {
+	if (data != nullptr) { munmap(const_cast<char*>(data), size); }
+	data = nullptr;
+	size = 0;
+}
+
+#endif
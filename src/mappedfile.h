@@ -0,0 +1,22 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+struct MappedFile {	//read-only view of an entire file mapped into memory, the mapping is released when this goes out of scope
+	const char* data = nullptr;
+	size_t size = 0;
+
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile() { Close(); }
+
+	bool Open(const std::string& path);	//returns false if the file couldn't be opened or mapped, an empty file opens fine with size 0
+	void Close();
+
+private:
+#ifdef _WIN32
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#endif
+};
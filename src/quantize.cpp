@@ -0,0 +1,125 @@
+#include "quantize.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "refract.h"
+#include "statistics.h"
+#include "threadpool.h"
+
+const double octahedralHalfRange = 32767;		//the grid spacing for the normals is 1/32767, with q = 32767 landing exactly on 0
+const uint16_t octahedralMax = 65534;
+const double fixedPointRange = 65535;			//vertex coordinates use every code
+const size_t raysPerQuantizeTask = size_t(1) << 16;
+
+static Eigen::Vector3d DecodeOctahedral(uint16_t qu, uint16_t qv) {	//same steps as the kernel in refract.cpp
+	double u = qu / octahedralHalfRange - 1, v = qv / octahedralHalfRange - 1;
+	Eigen::Vector3d n(u, v, 1 - std::abs(u) - std::abs(v));
+	double t = std::max(-n.z(), 0.0);	//the lower hemisphere is folded over the diagonals of the square
+	n.x() += n.x() >= 0 ? -t : t;
+	n.y() += n.y() >= 0 ? -t : t;
+	return n.normalized();
+}
+
+static double AngleBetween(const Eigen::Vector3d& a, const Eigen::Vector3d& b) { return 2 * std::atan2((a - b).norm(), (a + b).norm()); }	//for unit vectors, stays accurate for tiny angles unlike acos of the dot product
+
+static uint16_t OctahedralCode(double p) { return uint16_t(std::clamp(std::floor((p + 1) * octahedralHalfRange), 0.0, double(octahedralMax - 1))); }	//the grid point at or below p, so it and the one above bracket it
+
+static void EncodeNormal(const Eigen::Vector3d& normal, uint16_t* qu, uint16_t* qv, double* error) {	//projects onto the octahedron, then tries the four grid points around the projection
+	double l1 = std::abs(normal.x()) + std::abs(normal.y()) + std::abs(normal.z());
+	if (!(l1 > 0)) { *qu = *qv = uint16_t(octahedralHalfRange); *error = 0; return; }	//a zero or NaN normal has no direction to keep, it goes to +z
+	Eigen::Vector3d n = normal / l1;
+	double u = n.x(), v = n.y();
+	if (n.z() < 0) {
+		u = (1 - std::abs(n.y())) * (n.x() >= 0 ? 1 : -1);
+		v = (1 - std::abs(n.x())) * (n.y() >= 0 ? 1 : -1);
+	}
+	Eigen::Vector3d unit = normal.normalized();
+	uint16_t lowU = OctahedralCode(u), lowV = OctahedralCode(v);
+	*error = 1e300;
+	for (uint16_t cu = lowU; cu <= lowU + 1; cu++) {
+		for (uint16_t cv = lowV; cv <= lowV + 1; cv++) {	//rounding each coordinate on its own isn't always the closest direction, the octahedron stretches the grid unevenly
+			double candidate = AngleBetween(DecodeOctahedral(cu, cv), unit);
+			if (candidate < *error) { *qu = cu; *qv = cv; *error = candidate; }
+		}
+	}
+}
+
+bool QuantizeLens(std::span<const Eigen::Vector3d> vertices, std::span<const Eigen::Vector3d> normals, QuantizedLens* lens) {
+	ScopedTimer timer(Stage::Parse);	//it stands in for the load like the cache does
+	size_t numRays = vertices.size();
+	if (normals.size() != numRays) { return false; }
+	Eigen::Vector3d lowest = Eigen::Vector3d::Zero(), highest = Eigen::Vector3d::Zero();
+	if (numRays > 0) { lowest = highest = vertices[0]; }
+	for (const Eigen::Vector3d& vertex : vertices) {
+		lowest = lowest.cwiseMin(vertex);
+		highest = highest.cwiseMax(vertex);
+	}
+	QuantizedFrame& frame = lens->frame;
+	frame = {};
+	Eigen::Vector3d inverseScale;
+	for (int c = 0; c < 3; c++) {
+		frame.origin[c] = lowest[c];
+		frame.scale[c] = (highest[c] - lowest[c]) / fixedPointRange;	//0 for a flat lens, every vertex then sits on the origin exactly
+		inverseScale[c] = frame.scale[c] > 0 ? 1 / frame.scale[c] : 0;
+	}
+	lens->x.resize(numRays);
+	lens->y.resize(numRays);
+	lens->z.resize(numRays);
+	lens->u.resize(numRays);
+	lens->v.resize(numRays);
+
+	size_t numTasks = (numRays + raysPerQuantizeTask - 1) / raysPerQuantizeTask;
+	std::vector<double> positionErrors(numTasks), normalErrors(numTasks);	//per task maxima, combined once they're all done
+	GlobalThreadPool().ParallelForRange(numRays, raysPerQuantizeTask, [&](size_t begin, size_t end) {
+		double positionError = 0, normalError = 0;
+		AlignedVector<uint16_t>* components[3] = { &lens->x, &lens->y, &lens->z };
+		for (size_t i = begin; i < end; i++) {
+			for (int c = 0; c < 3; c++) { (*components[c])[i] = uint16_t(std::clamp(std::round((vertices[i][c] - frame.origin[c]) * inverseScale[c]), 0.0, fixedPointRange)); }
+			positionError = std::max(positionError, (DecodeVertex(*lens, i) - vertices[i]).norm());
+			double error;
+			EncodeNormal(normals[i], &lens->u[i], &lens->v[i], &error);
+			normalError = std::max(normalError, error);
+		}
+		positionErrors[begin / raysPerQuantizeTask] = positionError;
+		normalErrors[begin / raysPerQuantizeTask] = normalError;
+	});
+	for (size_t task = 0; task < numTasks; task++) {
+		frame.maxPositionError = std::max(frame.maxPositionError, positionErrors[task]);
+		frame.maxNormalError = std::max(frame.maxNormalError, normalErrors[task]);
+	}
+	return true;
+}
+
+Eigen::Vector3d DecodeVertex(const QuantizedLens& lens, size_t i) {
+	const uint16_t q[3] = { lens.x[i], lens.y[i], lens.z[i] };
+	Eigen::Vector3d vertex;
+	for (int c = 0; c < 3; c++) { vertex[c] = lens.frame.origin[c] + q[c] * lens.frame.scale[c]; }
+	return vertex;
+}
+
+Eigen::Vector3d DecodeNormal(const QuantizedLens& lens, size_t i) { return DecodeOctahedral(lens.u[i], lens.v[i]); }
+
+bool LoadQuantizedLens(const std::string& objFilePath, QuantizedLens* lens, VertexOrder order) {
+	std::string cachePath = LensCachePath(objFilePath, order, true);
+	{
+		ScopedTimer timer(Stage::Parse);
+		LensCache cache;
+		if (OpenLensCache(cachePath, objFilePath, &cache) && cache.quantized && cache.order == order) {	//the arrays are already in the form the kernels want, they just get copied out of the mapping
+			AlignedVector<uint16_t>* components[5] = { &lens->x, &lens->y, &lens->z, &lens->u, &lens->v };
+			for (int c = 0; c < 5; c++) { components[c]->assign(cache.quantizedArrays.components[c].begin(), cache.quantizedArrays.components[c].end()); }
+			lens->frame = cache.quantizedArrays.frame;
+			lens->hash = cache.sourceHash;
+			return true;
+		}
+	}
+
+	Lens full;
+	LoadLens(objFilePath, &full, order, false);	//uses a full cache if there is one, but doesn't leave one behind, a quantize run only ever wants its own
+	if (!QuantizeLens(full.vertices, full.normals, lens)) { return false; }
+	lens->hash = full.hash;
+	if (!WriteQuantizedLensCache(cachePath, objFilePath, lens->Arrays(), full.triangles, order)) { std::cout << "Couldn't write lens cache " << cachePath << "\n"; }
+	return true;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <string>
+#include "Eigen/Core"
+#include "lenscache.h"
+#include "raybuffer.h"
+
+//a lens in 10 bytes a ray instead of 48, each vertex as three 16 bit fixed point coordinates across the lens's bounding box and each normal as two 16 bit octahedral coordinates
+//the kernels decode it in registers as they load it, so the full precision lens never has to exist in memory
+
+struct QuantizedLens {	//structure of arrays like RayBuffer, ray i is element i of all five
+	AlignedVector<uint16_t> x, y, z;	//vertex coordinate c is frame.origin[c] + q*frame.scale[c]
+	AlignedVector<uint16_t> u, v;		//the normal's octahedral coordinates, q/32767 - 1 maps them to [-1, 1] with 0 exactly on the grid, 65535 is never used
+	QuantizedFrame frame = {};
+	uint64_t hash = 0;					//content hash of the .obj, same as Lens::hash
+
+	size_t size() const { return x.size(); }
+	QuantizedArrays Arrays() const { return { { x, y, z, u, v }, frame }; }
+};
+
+bool QuantizeLens(std::span<const Eigen::Vector3d> vertices, std::span<const Eigen::Vector3d> normals, QuantizedLens* lens);	//false if there isn't exactly one normal per vertex, fills in the frame's error bounds from the decoded lens
+//the normals are normalized first, each one gets whichever of the four nearest grid points decodes closest to it
+
+Eigen::Vector3d DecodeVertex(const QuantizedLens& lens, size_t i);
+Eigen::Vector3d DecodeNormal(const QuantizedLens& lens, size_t i);	//unit length, the same decode the kernels do
+
+bool LoadQuantizedLens(const std::string& objFilePath, QuantizedLens* lens, VertexOrder order = VertexOrder::File);	//from its quantized .lensbin when that's up to date, otherwise loads the lens in full, quantizes it and caches just the quantized form
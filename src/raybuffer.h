@@ -0,0 +1,64 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <span>
+#include <vector>
+#include "Eigen/Core"
+
+template<typename T>
+struct AlignedAllocator {	//hands out 64 byte aligned storage, one cache line and one avx-512 register
+	using value_type = T;
+	static constexpr std::align_val_t alignment{64};
+
+	AlignedAllocator() = default;
+	template<typename U> AlignedAllocator(const AlignedAllocator<U>&) {}
+
+	T* allocate(size_t n) { return static_cast<T*>(::operator new(n * sizeof(T), alignment)); }
+	void deallocate(T* p, size_t) { ::operator delete(p, alignment); }
+
+	template<typename U> bool operator==(const AlignedAllocator<U>&) const { return true; }
+	template<typename U> bool operator!=(const AlignedAllocator<U>&) const { return false; }
+};
+
+template<typename T> using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+#ifdef CAUSTICS_SINGLE_PRECISION
+using Real = float;		//build with -DCAUSTICS_SINGLE_PRECISION to run the solver in floats, twice the rays per instruction and half the memory traffic, the result only has to land in the right pixel of a 256x256 grid
+#else
+using Real = double;
+#endif
+
+template<typename Scalar>
+struct BasicRayBuffer {	//structure of arrays version of a list of Vector3d's, each component gets its own array so the kernels can load several rays per instruction
+	AlignedVector<Scalar> x;
+	AlignedVector<Scalar> y;
+	AlignedVector<Scalar> z;
+
+	size_t size() const { return x.size(); }
+	void resize(size_t n) { x.resize(n); y.resize(n); z.resize(n); }	//same as for the vector outputs, a reused buffer only allocates the first time
+};
+
+template<typename Scalar>
+struct BasicPointBuffer {	//structure of arrays version of a list of Vector2d's
+	AlignedVector<Scalar> x;
+	AlignedVector<Scalar> y;
+
+	size_t size() const { return x.size(); }
+	void resize(size_t n) { x.resize(n); y.resize(n); }
+};
+
+template<typename Scalar>
+struct BasicAffineIntersections {	//the intersection is affine in the receiver distance, so each ray's hit is offset + d*slope, both already in image coordinates
+	BasicPointBuffer<Scalar> offset;
+	BasicPointBuffer<Scalar> slope;
+
+	size_t size() const { return offset.size(); }
+	void resize(size_t n) { offset.resize(n); slope.resize(n); }
+};
+
+using RayBuffer = BasicRayBuffer<Real>;	//the precision the build runs the solver in
+using PointBuffer = BasicPointBuffer<Real>;
+using AffineIntersections = BasicAffineIntersections<Real>;
+
+template<typename Scalar>
+void ToRayBuffer(std::span<const Eigen::Vector3d> vectors, BasicRayBuffer<Scalar>* rays);	//splits the components out into separate arrays, rounding to floats for a single precision buffer
@@ -1,74 +1,1176 @@
 #include "refract.h"
 
-std::vector<std::string> split(std::string s, std::string delimiter) {	//splits a string into several smaller strings separated by a given delimiter, from https://stackoverflow.com/questions/14265581/parse-split-a-string-in-c-using-string-delimiter-standard-c
-	size_t pos_start = 0, pos_end, delim_len = delimiter.length();
-	std::string token;
-	std::vector<std::string> res;
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
 
-	while ((pos_end = s.find(delimiter, pos_start)) != std::string::npos) {
-		token = s.substr(pos_start, pos_end - pos_start);
-		pos_start = pos_end + delim_len;
-		res.push_back(token);
+#include "mappedfile.h"
+#include "reorder.h"
+#include "simd.h"
+#include "statistics.h"
+#include "threadpool.h"
+
+const size_t raysPerChunk = size_t(1) << 14;	//rays per parallel task, 16K rays of the double precision intersect kernel streams about 1MB, so a thread's chunk stays in its L2
+
+static const char* SkipSpaces(const char* p, const char* end) {	//skips spaces and tabs but stops at the end of the line
+	while (p < end && (*p == ' ' || *p == '\t')) { p++; }
+	return p;
+}
+
+static const char* NextLine(const char* p, const char* end) {	//returns the first character after the next newline, or end if there isn't one
+	const char* newline = static_cast<const char*>(memchr(p, '\n', size_t(end - p)));
+	return newline ? newline + 1 : end;
+}
+
+static bool ParseVector(const char* p, const char* end, Eigen::Vector3d* vector) {	//parses three whitespace separated numbers in place, no allocations and no locale lookups unlike std::stod
+	for (int i = 0; i < 3; i++) {
+		p = SkipSpaces(p, end);
+		if (p < end && *p == '+') { p++; }	//from_chars doesn't accept an explicit plus sign but some exporters write one
+		std::from_chars_result result = std::from_chars(p, end, (*vector)[i]);
+		if (result.ec != std::errc()) { return false; }
+		p = result.ptr;
 	}
+	return true;
+}
 
-	res.push_back(s.substr(pos_start));
-	return res;
+struct OBJFace {	//a triangle as written in the file, 1 based with negative indices counting back from the latest vertex
+	int64_t vertices[3];
+	int64_t normals[3];		//noNormalIndex where the face didn't give one
+	uint8_t relative = 0;	//bit c for vertex corner c and bit 3 + c for normal corner c when the index counts back, those are resolved against this chunk's own arrays so far and fixed up while stitching
+};
+
+const int64_t noNormalIndex = INT64_MIN;	//for "f 1 2 3" and "f 1/1 2/2 3/3", the normal is then the one with the vertex's index, the same pairing as the one ray per vertex path assumes
+
+struct OBJChunk {	//what one thread found in its slice of the file
+	std::vector<Eigen::Vector3d> vertices;
+	std::vector<Eigen::Vector3d> normals;
+	std::vector<OBJFace> faces;
+	size_t malformedLines = 0;
+};
+
+static bool EndOfToken(const char* p, const char* end) { return p == end || *p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'; }
+
+static bool ParseIndex(const char** p, const char* end, size_t count, int64_t* index, bool* relative) {	//one 1 based index, resolved to 0 based with negative ones relative to count
+	int64_t value;
+	std::from_chars_result result = std::from_chars(*p, end, value);
+	if (result.ec != std::errc() || value == 0) { return false; }
+	*relative = value < 0;
+	*index = value > 0 ? value - 1 : int64_t(count) + value;
+	*p = result.ptr;
+	return true;
 }
 
-void ParseOBJ(std::string objFilePath, std::vector<Eigen::Vector3d>* vertices, std::vector<Eigen::Vector3d>* normals) {	//takes in an .obj file and populates vertices and normals from the file
-	
-	std::string line;
-	std::ifstream file(objFilePath);
-	if (file.is_open()) {
-		while (std::getline(file, line))
-		{
-			if (line.substr(0,2) == "v ") {
-				std::vector<std::string> lineContents = split(line, " ");
-				Eigen::Vector3d vertex(std::stod(lineContents[1]), std::stod(lineContents[2]), std::stod(lineContents[3]));
-				vertices->push_back(vertex);
+static bool ParseFace(const char* p, const char* end, OBJChunk* chunk) {	//one f record, vertex/texture/normal corners in any of the four forms, anything bigger than a triangle becomes a fan
+	OBJFace face;
+	int corners = 0;
+	while (true) {
+		p = SkipSpaces(p, end);
+		if (p == end || *p == '\r' || *p == '\n' || *p == '#') { break; }
+		int c = std::min(corners, 2);	//past the third corner the new one replaces the last, the first stays put
+		bool relative;
+		int64_t vertex, normal = noNormalIndex;
+		if (!ParseIndex(&p, end, chunk->vertices.size(), &vertex, &relative)) { return false; }
+		bool relativeNormal = false;
+		if (p < end && *p == '/') {
+			p++;
+			while (p < end && *p != '/' && !EndOfToken(p, end)) { p++; }	//texture coordinates aren't needed
+			if (p < end && *p == '/') {
+				p++;
+				if (!ParseIndex(&p, end, chunk->normals.size(), &normal, &relativeNormal)) { return false; }
 			}
-			else if (line.substr(0, 2) == "vn") {
-				std::vector<std::string> lineContents = split(line, " ");
-				Eigen::Vector3d normal(std::stod(lineContents[1]), std::stod(lineContents[2]), std::stod(lineContents[3]));
-				normals->push_back(normal);
+		}
+		if (!EndOfToken(p, end)) { return false; }
+		if (corners >= 3) {	//fan around the first corner, the previous corner becomes the middle one
+			face.vertices[1] = face.vertices[2];
+			face.normals[1] = face.normals[2];
+			face.relative = uint8_t((face.relative & 0b001001) | ((face.relative & 0b100100) >> 1));
+		}
+		face.vertices[c] = vertex;
+		face.normals[c] = normal;
+		face.relative = uint8_t((face.relative & ~((1 << c) | (8 << c))) | (relative ? 1 << c : 0) | (relativeNormal ? 8 << c : 0));
+		if (++corners >= 3) { chunk->faces.push_back(face); }
+	}
+	return corners >= 3;
+}
+
+static void ParseOBJChunk(const char* begin, const char* end, bool parseFaces, OBJChunk* chunk) {	//parses the v, vn and, with parseFaces, f records between begin and end, which both sit on line boundaries
+	for (const char* line = begin; line < end; line = NextLine(line, end)) {	//walk the mapped file in place instead of copying every line out into a std::string
+		if (end - line < 2) { break; }
+		Eigen::Vector3d vector;
+		if (line[0] == 'v' && line[1] == ' ') {
+			if (ParseVector(line + 2, end, &vector)) { chunk->vertices.push_back(vector); }
+			else { chunk->malformedLines++; }
+		}
+		else if (line[0] == 'v' && line[1] == 'n') {
+			if (ParseVector(line + 2, end, &vector)) { chunk->normals.push_back(vector); }
+			else { chunk->malformedLines++; }
+		}
+		else if (line[0] == 'f' && (line[1] == ' ' || line[1] == '\t') && parseFaces) {
+			size_t numFaces = chunk->faces.size();
+			if (!ParseFace(line + 2, end, chunk)) {
+				chunk->faces.resize(numFaces);	//drop whatever part of the fan made it in
+				chunk->malformedLines++;
 			}
-			else if (line.substr(0, 2) == "vt") { break; }	//we don't care about anything beyond the vertices and normals, no point reading stuff we're not going to use
 		}
-		file.close();
 	}
-	else { std::cout << "Invalid file\n"; }
 }
 
-void Refract(std::vector<Eigen::Vector3d> normals, std::vector<Eigen::Vector3d>* refracteds, double eta) {	//computes refracted light vectors from incident and normal vectors, reference https://graphics.stanford.edu/courses/cs148-10-summer/docs/2006--degreve--reflection_refraction.pdf
+static bool ResolveIndex(int64_t index, bool relative, int64_t chunkStart, int64_t count, uint32_t* resolved) {
+	if (relative) { index += chunkStart; }
+	if (index < 0 || index >= count || index >= int64_t(UINT32_MAX)) { return false; }
+	*resolved = uint32_t(index);
+	return true;
+}
+
+void ParseOBJ(const std::string& objFilePath, std::vector<Eigen::Vector3d>* vertices, std::vector<Eigen::Vector3d>* normals, bool useLensCache, std::vector<Triangle>* triangles) {	//takes in an .obj file and populates vertices and normals from the file
+	
+	ScopedTimer timer(Stage::Parse);
+	std::string cachePath = LensCachePath(objFilePath);
+	if (useLensCache) {
+		LensCache cache;
+		if (OpenLensCache(cachePath, objFilePath, &cache) && !cache.quantized && cache.order == VertexOrder::File) {	//unchanged since last time, just copy the arrays out of the mapping
+			vertices->insert(vertices->end(), cache.vertices, cache.vertices + cache.numVertices);
+			normals->insert(normals->end(), cache.normals, cache.normals + cache.numNormals);
+			if (triangles != nullptr) { triangles->insert(triangles->end(), cache.triangles, cache.triangles + cache.numTriangles); }
+			return;
+		}
+	}
+
+	MappedFile file;
+	if (!file.Open(objFilePath)) { std::cout << "Invalid file\n"; return; }
+	std::vector<Triangle> cacheTriangles;	//the cache always gets the faces, so a later run that wants them can still use it
+	if (useLensCache && triangles == nullptr) { triangles = &cacheTriangles; }
+	bool parseFaces = triangles != nullptr;
+
+	//split the file into newline aligned chunks, several per thread so a chunk full of faces doesn't leave the other threads idle
+	const size_t minChunkSize = size_t(1) << 22;
+	ThreadPool& pool = GlobalThreadPool();
+	size_t numChunks = std::max<size_t>(1, std::min<size_t>(size_t(pool.NumThreads()) * 4, file.size / minChunkSize));
+	const char* fileEnd = file.data + file.size;
+	std::vector<const char*> boundaries(numChunks + 1, fileEnd);
+	boundaries[0] = file.data;
+	for (size_t i = 1; i < numChunks; i++) {
+		const char* guess = std::max(boundaries[i - 1], file.data + file.size / numChunks * i);
+		boundaries[i] = guess == file.data ? guess : NextLine(guess - 1, fileEnd);	//move forward to the start of the next line, stepping back one so a guess that already sits on a line start stays put
+	}
+
+	std::vector<OBJChunk> chunks(numChunks);
+	pool.ParallelFor(numChunks, [&](size_t i) { ParseOBJChunk(boundaries[i], boundaries[i + 1], parseFaces, &chunks[i]); });	//v and vn records count wherever they are in the file, faces or not, so every way of loading a lens sees the same rays
+
+	//stitch the chunks back together in file order so the indexing matches a front to back read
+	size_t lastChunk = numChunks - 1;
+	std::vector<size_t> vertexOffsets(lastChunk + 2, vertices->size());
+	std::vector<size_t> normalOffsets(lastChunk + 2, normals->size());
+	std::vector<size_t> faceOffsets(lastChunk + 2, parseFaces ? triangles->size() : 0);
+	size_t malformedLines = 0;
+	for (size_t i = 0; i <= lastChunk; i++) {
+		vertexOffsets[i + 1] = vertexOffsets[i] + chunks[i].vertices.size();
+		normalOffsets[i + 1] = normalOffsets[i] + chunks[i].normals.size();
+		faceOffsets[i + 1] = faceOffsets[i] + chunks[i].faces.size();
+		malformedLines += chunks[i].malformedLines;
+	}
+	vertices->resize(vertexOffsets[lastChunk + 1]);
+	normals->resize(normalOffsets[lastChunk + 1]);
+	if (parseFaces) { triangles->resize(faceOffsets[lastChunk + 1]); }
+	int64_t fileVertices = int64_t(vertexOffsets[lastChunk + 1] - vertexOffsets[0]), fileNormals = int64_t(normalOffsets[lastChunk + 1] - normalOffsets[0]);
+	std::atomic<size_t> badFaces{0};
+	pool.ParallelFor(lastChunk + 1, [&](size_t i) {
+		std::copy(chunks[i].vertices.begin(), chunks[i].vertices.end(), vertices->begin() + vertexOffsets[i]);
+		std::copy(chunks[i].normals.begin(), chunks[i].normals.end(), normals->begin() + normalOffsets[i]);
+		int64_t vertexStart = int64_t(vertexOffsets[i] - vertexOffsets[0]), normalStart = int64_t(normalOffsets[i] - normalOffsets[0]);
+		size_t bad = 0;
+		for (size_t f = 0; f < chunks[i].faces.size(); f++) {	//indices become relative to this file's first vertex and normal
+			const OBJFace& face = chunks[i].faces[f];
+			Triangle& triangle = (*triangles)[faceOffsets[i] + f];
+			bool valid = true;
+			for (int c = 0; c < 3; c++) {
+				valid = valid && ResolveIndex(face.vertices[c], face.relative & (1 << c), vertexStart, fileVertices, &triangle.vertices[c]);
+				if (face.normals[c] == noNormalIndex) { triangle.normals[c] = triangle.vertices[c]; valid = valid && int64_t(triangle.normals[c]) < fileNormals; }
+				else { valid = valid && ResolveIndex(face.normals[c], face.relative & (8 << c), normalStart, fileNormals, &triangle.normals[c]); }
+			}
+			if (!valid) { triangle.vertices[0] = UINT32_MAX; bad++; }	//marked for removal below
+		}
+		badFaces += bad;
+		chunks[i] = OBJChunk();	//hand the memory back as we go, the chunks together are as big as the output
+	});
+	if (malformedLines > 0) { std::cout << "Skipped " << malformedLines << " malformed vertex/normal/face lines\n"; }
+	if (badFaces > 0) {	//rare enough that a serial pass over the faces is fine
+		std::cout << "Skipped " << badFaces << " faces with out of range indices\n";
+		triangles->erase(std::remove_if(triangles->begin() + faceOffsets[0], triangles->end(), [](const Triangle& triangle) { return triangle.vertices[0] == UINT32_MAX; }), triangles->end());
+	}
+
+	if (useLensCache) {
+		std::span<const Eigen::Vector3d> newVertices(vertices->data() + vertexOffsets[0], vertexOffsets[lastChunk + 1] - vertexOffsets[0]);
+		std::span<const Eigen::Vector3d> newNormals(normals->data() + normalOffsets[0], normalOffsets[lastChunk + 1] - normalOffsets[0]);
+		std::span<const Triangle> newTriangles(triangles->data() + faceOffsets[0], triangles->size() - faceOffsets[0]);
+		if (!WriteLensCache(cachePath, objFilePath, newVertices, newNormals, newTriangles)) { std::cout << "Couldn't write lens cache " << cachePath << "\n"; }
+	}
+}
+
+void LoadLens(const std::string& objFilePath, Lens* lens, VertexOrder order, bool writeCache) {
+	ScopedTimer timer(Stage::Parse);	//mapping the cache counts as parsing, it's what it stands in for
+	std::string cachePath = LensCachePath(objFilePath, order);
+	if (OpenLensCache(cachePath, objFilePath, &lens->cache) && !lens->cache.quantized && lens->cache.order == order) {	//unchanged since last time, hand out the mapped arrays as they are
+		lens->vertices = std::span<const Eigen::Vector3d>(lens->cache.vertices, lens->cache.numVertices);
+		lens->normals = std::span<const Eigen::Vector3d>(lens->cache.normals, lens->cache.numNormals);
+		lens->triangles = std::span<const Triangle>(lens->cache.triangles, lens->cache.numTriangles);
+		lens->hash = lens->cache.sourceHash;
+		return;
+	}
+	lens->cache.file.Close();
+	bool fromCache = false;
+	if (order != VertexOrder::File) {	//the file order cache is only a reordering away from what was asked for
+		LensCache fileOrder;
+		fromCache = OpenLensCache(LensCachePath(objFilePath), objFilePath, &fileOrder) && !fileOrder.quantized && fileOrder.order == VertexOrder::File;
+		if (fromCache) {
+			lens->parsedVertices.assign(fileOrder.vertices, fileOrder.vertices + fileOrder.numVertices);
+			lens->parsedNormals.assign(fileOrder.normals, fileOrder.normals + fileOrder.numNormals);
+			lens->parsedTriangles.assign(fileOrder.triangles, fileOrder.triangles + fileOrder.numTriangles);
+			lens->hash = fileOrder.sourceHash;
+		}
+	}
+	if (!fromCache) {
+		ParseOBJ(objFilePath, &lens->parsedVertices, &lens->parsedNormals, writeCache, &lens->parsedTriangles);	//no usable cache, so parse the text, writing the caches leaves a fresh file order one behind for next time
+		MappedFile source;
+		if (source.Open(objFilePath)) { lens->hash = HashFile(source); }
+	}
+	if (order == VertexOrder::Hilbert) {
+		if (!ReorderAlongHilbertCurve(&lens->parsedVertices, &lens->parsedNormals, &lens->parsedTriangles)) { std::cout << "The lens doesn't have one normal per vertex, keeping the file order\n"; }
+		else if (writeCache && !WriteLensCache(cachePath, objFilePath, lens->parsedVertices, lens->parsedNormals, lens->parsedTriangles, VertexOrder::Hilbert)) { std::cout << "Couldn't write lens cache " << cachePath << "\n"; }
+	}
+	lens->vertices = lens->parsedVertices;
+	lens->normals = lens->parsedNormals;
+	lens->triangles = lens->parsedTriangles;
+}
+
+bool OpenLensStream(const std::string& objFilePath, LensStream* stream) {
+	stream->fromCache = OpenLensCache(LensCachePath(objFilePath), objFilePath, &stream->cache) && !stream->cache.quantized;	//the file order cache, which any LoadLens that parses leaves behind whatever order it was asked for
+	if (stream->fromCache) { return true; }
+	stream->cache.file.Close();
+	if (!stream->file.Open(objFilePath)) { std::cout << "Invalid file\n"; return false; }
+	stream->nextVertexLine = stream->file.data;
+	stream->nextNormalLine = stream->file.data;
+	return true;
+}
+
+static const char* FindRecords(const char* p, const char* end, char kind, size_t maxLines, std::vector<const char*>* lines) {	//the starts of up to maxLines v (kind ' ') or vn (kind 'n') lines, returns where to carry on, end once there are no more
+	lines->clear();
+	for (; p < end && lines->size() < maxLines; p = NextLine(p, end)) {
+		if (end - p < 2) { return end; }
+		if (p[0] == 'v' && p[1] == kind) { lines->push_back(p); }	//right through the file, a vt line doesn't end it any more than it ends ParseOBJ
+	}
+	return p;
+}
+
+static size_t ParseRecords(const std::vector<const char*>& lines, const char* end, std::vector<Eigen::Vector3d>* parsed) {	//appends the ones that parse in file order, returns how many didn't
+	size_t first = parsed->size();
+	parsed->resize(first + lines.size());
+	std::vector<uint8_t> valid(lines.size());
+	GlobalThreadPool().ParallelForRange(lines.size(), raysPerChunk, [&](size_t begin, size_t last) {
+		for (size_t i = begin; i < last; i++) { valid[i] = ParseVector(lines[i] + 2, end, &(*parsed)[first + i]); }
+	});
+	size_t kept = first;
+	for (size_t i = 0; i < lines.size(); i++) {
+		if (valid[i]) { (*parsed)[kept++] = (*parsed)[first + i]; }
+	}
+	parsed->resize(kept);
+	return first + lines.size() - kept;
+}
+
+template<typename Scalar>
+size_t ReadLensBlock(LensStream* stream, size_t maxRays, BasicRayBuffer<Scalar>* vertices, BasicRayBuffer<Scalar>* normals) {
+	ScopedTimer timer(Stage::Parse);
+	maxRays = std::min(maxRays, stream->remaining);
+	if (stream->fromCache) {	//the mapping only pulls in the pages we copy out of, and they can be dropped again once we've moved past them
+		size_t numRays = std::min(std::min(stream->cache.numVertices, stream->cache.numNormals) - stream->position, maxRays);
+		ToRayBuffer(std::span<const Eigen::Vector3d>(stream->cache.vertices + stream->position, numRays), vertices);
+		ToRayBuffer(std::span<const Eigen::Vector3d>(stream->cache.normals + stream->position, numRays), normals);
+		stream->position += numRays;
+		stream->remaining -= numRays;
+		return numRays;
+	}
 
-	int numPoints = int(normals.size());		//vertices, normals, and refracteds will all have the same number of elements
+	const char* end = stream->file.data + stream->file.size;
+	while (stream->pendingVertices.size() < maxRays && stream->nextVertexLine < end) {
+		stream->nextVertexLine = FindRecords(stream->nextVertexLine, end, ' ', maxRays - stream->pendingVertices.size(), &stream->lines);
+		stream->malformedLines += ParseRecords(stream->lines, end, &stream->pendingVertices);
+	}
+	while (stream->pendingNormals.size() < maxRays && stream->nextNormalLine < end) {
+		stream->nextNormalLine = FindRecords(stream->nextNormalLine, end, 'n', maxRays - stream->pendingNormals.size(), &stream->lines);
+		stream->malformedLines += ParseRecords(stream->lines, end, &stream->pendingNormals);
+	}
+	size_t numRays = std::min({ maxRays, stream->pendingVertices.size(), stream->pendingNormals.size() });
+	ToRayBuffer(std::span<const Eigen::Vector3d>(stream->pendingVertices.data(), numRays), vertices);
+	ToRayBuffer(std::span<const Eigen::Vector3d>(stream->pendingNormals.data(), numRays), normals);
+	stream->pendingVertices.erase(stream->pendingVertices.begin(), stream->pendingVertices.begin() + ptrdiff_t(numRays));	//whatever's left over goes first next time
+	stream->pendingNormals.erase(stream->pendingNormals.begin(), stream->pendingNormals.begin() + ptrdiff_t(numRays));
+	stream->remaining -= numRays;
+	return numRays;
+}
+
+template<typename F>
+static void ForEachRecord(const char* p, const char* end, F&& visit) {	//visit(kind, line) for every v and vn line in the order FindRecords would find them
+	for (; end - p >= 2; p = NextLine(p, end)) {
+		if (p[0] == 'v' && (p[1] == ' ' || p[1] == 'n')) { visit(p[1], p); }
+	}
+}
+
+bool PlanLensShards(const std::string& objFilePath, size_t numShards, LensShardPlan* plan) {
+	ScopedTimer timer(Stage::Parse);
+	LensStream probe;
+	if (numShards == 0 || !OpenLensStream(objFilePath, &probe)) { return false; }
+	plan->fromCache = probe.fromCache;
+	plan->shards.assign(numShards, LensShard());
+	if (probe.fromCache) {	//the arrays are fixed size records, so the split is just arithmetic
+		const char* base = probe.cache.file.data;
+		size_t numRays = std::min(probe.cache.numVertices, probe.cache.numNormals);
+		plan->sourceSize = probe.cache.file.size;
+		plan->sourceHash = probe.cache.sourceHash;
+		for (size_t k = 0; k < numShards; k++) {
+			size_t begin = numRays * k / numShards, end = numRays * (k + 1) / numShards;
+			plan->shards[k].vertexOffset = uint64_t(reinterpret_cast<const char*>(probe.cache.vertices + begin) - base);
+			plan->shards[k].normalOffset = uint64_t(reinterpret_cast<const char*>(probe.cache.normals + begin) - base);
+			plan->shards[k].numRays = end - begin;
+		}
+		return true;
+	}
+
+	const char* data = probe.file.data, *end = data + probe.file.size;
+	plan->sourceSize = probe.file.size;
+	plan->sourceHash = 0;
+	size_t numVertices = 0, numNormals = 0;	//one pass to count the records and another to find where each shard starts, only the line starts get looked at, nothing is parsed
+	ForEachRecord(data, end, [&](char kind, const char*) { (kind == ' ' ? numVertices : numNormals)++; });
+	size_t numRays = std::min(numVertices, numNormals);
+	size_t vertexIndex = 0, normalIndex = 0, nextVertexShard = 0, nextNormalShard = 0;
+	auto shardStart = [&](size_t k) { return numRays * k / numShards; };
+	ForEachRecord(data, end, [&](char kind, const char* line) {
+		size_t& index = kind == ' ' ? vertexIndex : normalIndex;
+		size_t& shard = kind == ' ' ? nextVertexShard : nextNormalShard;
+		for (; shard < numShards && shardStart(shard) == index; shard++) { (kind == ' ' ? plan->shards[shard].vertexOffset : plan->shards[shard].normalOffset) = uint64_t(line - data); }
+		index++;
+	});
+	for (size_t k = 0; k < numShards; k++) {
+		if (k >= nextVertexShard) { plan->shards[k].vertexOffset = probe.file.size; }	//empty shards past the last record
+		if (k >= nextNormalShard) { plan->shards[k].normalOffset = probe.file.size; }
+		plan->shards[k].numRays = shardStart(k + 1) - shardStart(k);
+	}
+	return true;
+}
+
+bool OpenLensShard(const std::string& objFilePath, const LensShardPlan& plan, size_t shard, LensStream* stream) {
+	if (shard >= plan.shards.size()) { return false; }
+	const LensShard& piece = plan.shards[shard];
+	stream->remaining = size_t(piece.numRays);
+	if (plan.fromCache) {
+		stream->fromCache = OpenLensCache(LensCachePath(objFilePath), objFilePath, &stream->cache) && !stream->cache.quantized;
+		if (!stream->fromCache || stream->cache.file.size != plan.sourceSize || stream->cache.sourceHash != plan.sourceHash) { return false; }
+		uint64_t vertexBase = uint64_t(reinterpret_cast<const char*>(stream->cache.vertices) - stream->cache.file.data);
+		uint64_t normalBase = uint64_t(reinterpret_cast<const char*>(stream->cache.normals) - stream->cache.file.data);
+		if (piece.vertexOffset < vertexBase || (piece.vertexOffset - vertexBase) % sizeof(Eigen::Vector3d) != 0) { return false; }
+		stream->position = size_t((piece.vertexOffset - vertexBase) / sizeof(Eigen::Vector3d));
+		return normalBase + stream->position * sizeof(Eigen::Vector3d) == piece.normalOffset && stream->position + stream->remaining <= std::min(stream->cache.numVertices, stream->cache.numNormals);
+	}
+	stream->fromCache = false;
+	if (!stream->file.Open(objFilePath) || stream->file.size != plan.sourceSize || piece.vertexOffset > stream->file.size || piece.normalOffset > stream->file.size) { return false; }
+	stream->nextVertexLine = stream->file.data + piece.vertexOffset;
+	stream->nextNormalLine = stream->file.data + piece.normalOffset;
+	return true;
+}
+
+void Refract(std::span<const Eigen::Vector3d> normals, std::vector<Eigen::Vector3d>* refracteds, double eta) {	//computes refracted light vectors from incident and normal vectors, reference https://graphics.stanford.edu/courses/cs148-10-summer/docs/2006--degreve--reflection_refraction.pdf
+
+	size_t numPoints = normals.size();		//vertices, normals, and refracteds will all have the same number of elements
+	refracteds->resize(numPoints);			//only allocates the first time, after that the buffer is reused
 	Eigen::Vector3d incident(0, 0, 1);			//assume light always arrives at the interface pointing in the positive z direction
 	Eigen::Vector3d TIR(.9999, 0, 0.0141418);	//in the case of total internal reflection, shoot the light way off to the side in an arbitrary direction so that it doesn't show up on the part of the screen we see
+	ScopedTimer timer(Stage::Refract);
+
+	GlobalThreadPool().ParallelForRange(numPoints, raysPerChunk, [&](size_t begin, size_t end) {	//every ray is independent, so each thread just takes a chunk at a time
+		size_t reflected = 0;
+		for (size_t i = begin; i < end; i++) {
+			double cosIncidenceAngle = normals[i].z();	//incident dot normal = 0*Nx + 0*Ny + 1*Nz = Nz
+			double sinRefractedAngle2 = eta * eta * (1 - cosIncidenceAngle * cosIncidenceAngle);	//eta1/eta2 = eta1 = eta, since the second medium is just air with eta2 = 1
+			
+			if (sinRefractedAngle2 <= 1) {		//check for total interal reflection
+				(*refracteds)[i] = eta * incident - (eta * cosIncidenceAngle - std::sqrt(1 - sinRefractedAngle2)) * normals[i];
+			}
+			else
+			{
+				(*refracteds)[i] = TIR;		//out of sight, out of mind :)
+				reflected++;
+			}									
+		}
+		CountRefracted(end - begin, reflected);
+	});
+}
+
+void CalculateIntersections(std::span<const Eigen::Vector3d> vertices, std::span<const Eigen::Vector3d> refracteds, std::vector<Eigen::Vector2d>* intersections, double receiver_plane) {	//returns the points on the receiver plane where the light rays from each vertex intersect
+
+	ScopedTimer timer(Stage::Intersect);
+	size_t numPoints = vertices.size();
+	intersections->resize(numPoints);	//overwrite the intersections every time we call the function, same size every time so this never reallocates
+
+	GlobalThreadPool().ParallelForRange(numPoints, raysPerChunk, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			double t = (receiver_plane - vertices[i].z()) / refracteds[i].z();	//solve for t in vertex.z + ray.z*t = receiever_plane.z
+			Eigen::Vector2d intersection(vertices[i].x() + refracteds[i].x() * t, vertices[i].y() + refracteds[i].y() * t);
+			(*intersections)[i] = intersection * 128 + Eigen::Vector2d(128, 128); //vertices x,y range between (-1,1), transform to go from (0,256) to match the 256x256 target image
+		}
+	});
+}
+
+template<typename Scalar>
+void ToRayBuffer(std::span<const Eigen::Vector3d> vectors, BasicRayBuffer<Scalar>* rays) {
+	rays->resize(vectors.size());
+	GlobalThreadPool().ParallelForRange(vectors.size(), raysPerChunk, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			rays->x[i] = Scalar(vectors[i].x());
+			rays->y[i] = Scalar(vectors[i].y());
+			rays->z[i] = Scalar(vectors[i].z());
+		}
+	});
+}
+
+template<typename B>
+struct RefractConstants {	//broadcast once per chunk rather than once per batch
+	B one, zero, eta, eta2, tirX, tirY, tirZ;
+	using Element = typename B::Element;
+	explicit RefractConstants(double n) : one(B::Broadcast(1)), zero(B::Broadcast(0)), eta(B::Broadcast(Element(n))), eta2(B::Broadcast(Element(n * n))),
+		tirX(B::Broadcast(Element(.9999))), tirY(B::Broadcast(0)), tirZ(B::Broadcast(Element(0.0141418))) {}	//same total internal reflection direction as above
+};
+
+template<typename B>
+static inline size_t RefractBatch(const RefractConstants<B>& c, B nx, B ny, B nz, B sinIncidenceAngle2, B* rx, B* ry, B* rz) {	//for when the incidence angle is shared between several indices, returns how many lanes took the total internal reflection fallback
+	B cosIncidenceAngle = nz;
+	B sinRefractedAngle2 = c.eta2 * sinIncidenceAngle2;
+	typename B::Mask refracts = sinRefractedAngle2 <= c.one;
+	B k = c.eta * cosIncidenceAngle - Sqrt(Max(c.one - sinRefractedAngle2, c.zero));	//clamped so total internal reflection lanes don't produce NaNs, they get replaced below anyway
+	*rx = Select(refracts, c.zero - k * nx, c.tirX);	//refracted = eta*incident - k*normal with incident = (0, 0, 1), blended instead of branched
+	*ry = Select(refracts, c.zero - k * ny, c.tirY);
+	*rz = Select(refracts, c.eta - k * cosIncidenceAngle, c.tirZ);
+	return B::width - CountSet(refracts);
+}
+
+template<typename B>
+static inline size_t RefractBatch(const RefractConstants<B>& c, B nx, B ny, B nz, B* rx, B* ry, B* rz) {	//same math as the Vector3d version, B::width rays at a time
+	return RefractBatch(c, nx, ny, nz, c.one - nz * nz, rx, ry, rz);
+}
+
+template<typename B>
+static inline size_t RefractBatch(const RefractConstants<B>& c, B ix, B iy, B iz, B nx, B ny, B nz, B cosIncidenceAngle, B sinIncidenceAngle2, B* rx, B* ry, B* rz) {	//any incident direction, the two above are this with incident = (0, 0, 1) folded in
+	B sinRefractedAngle2 = c.eta2 * sinIncidenceAngle2;
+	typename B::Mask refracts = sinRefractedAngle2 <= c.one;
+	B k = c.eta * cosIncidenceAngle - Sqrt(Max(c.one - sinRefractedAngle2, c.zero));
+	*rx = Select(refracts, c.eta * ix - k * nx, c.tirX);
+	*ry = Select(refracts, c.eta * iy - k * ny, c.tirY);
+	*rz = Select(refracts, c.eta * iz - k * nz, c.tirZ);
+	return B::width - CountSet(refracts);
+}
+
+//incident directions for the general kernels, worked out per batch from the vertices
+
+template<typename B>
+struct DirectionalIncidence {	//collimated light, the same incident vector for every ray
+	B x, y, z;
+	explicit DirectionalIncidence(const Light& light) {
+		Eigen::Vector3d direction = light.direction.normalized();
+		x = B::Broadcast(typename B::Element(direction.x()));
+		y = B::Broadcast(typename B::Element(direction.y()));
+		z = B::Broadcast(typename B::Element(direction.z()));
+	}
+	void operator()(B, B, B, B* ix, B* iy, B* iz) const { *ix = x; *iy = y; *iz = z; }	//the vertex loads this ignores get optimized away
+};
+
+template<typename B>
+struct PointIncidence {	//light spreading out from a point, the incident vector is the normalized direction from the light to each vertex
+	B x, y, z, one;
+	explicit PointIncidence(const Light& light) : x(B::Broadcast(typename B::Element(light.position.x()))), y(B::Broadcast(typename B::Element(light.position.y()))),
+		z(B::Broadcast(typename B::Element(light.position.z()))), one(B::Broadcast(1)) {}
+	void operator()(B vx, B vy, B vz, B* ix, B* iy, B* iz) const {
+		B dx = vx - x, dy = vy - y, dz = vz - z;
+		B inverseLength = one / Sqrt(FusedMultiplyAdd(dx, dx, FusedMultiplyAdd(dy, dy, dz * dz)));
+		*ix = dx * inverseLength;
+		*iy = dy * inverseLength;
+		*iz = dz * inverseLength;
+	}
+};
+
+template<typename B>
+static inline void IntersectBatch(B plane, B vx, B vy, B vz, B rx, B ry, B rz, B* ix, B* iy) {
+	const B scale = B::Broadcast(128), offset = B::Broadcast(128);
+	B t = (plane - vz) / rz;	//solve for t in vertex.z + ray.z*t = receiever_plane.z
+	*ix = FusedMultiplyAdd(FusedMultiplyAdd(rx, t, vx), scale, offset);	//(vertex + ray*t)*128 + 128, same transform to the 256x256 target image as above
+	*iy = FusedMultiplyAdd(FusedMultiplyAdd(ry, t, vy), scale, offset);
+}
+
+template<typename B, typename Scalar>
+static size_t RefractKernel(const BasicRayBuffer<Scalar>& normals, BasicRayBuffer<Scalar>* refracteds, size_t begin, size_t end, double eta) {	//the kernels all return their total internal reflection count
+	const RefractConstants<B> c(eta);
+	size_t reflected = 0;
+	for (size_t i = begin; i + B::width <= end; i += B::width) {
+		B rx, ry, rz;
+		reflected += RefractBatch(c, B::Load(&normals.x[i]), B::Load(&normals.y[i]), B::Load(&normals.z[i]), &rx, &ry, &rz);
+		rx.Store(&refracteds->x[i]);
+		ry.Store(&refracteds->y[i]);
+		rz.Store(&refracteds->z[i]);
+	}
+	return reflected;
+}
+
+template<typename B, typename Incidence, typename Scalar>
+static size_t LitRefractKernel(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& normals, BasicRayBuffer<Scalar>* refracteds, size_t begin, size_t end, double eta, const Light& light) {
+	const RefractConstants<B> c(eta);
+	const Incidence incidence(light);
+	size_t reflected = 0;
+	for (size_t i = begin; i + B::width <= end; i += B::width) {
+		B ix, iy, iz, rx, ry, rz;
+		incidence(B::Load(&vertices.x[i]), B::Load(&vertices.y[i]), B::Load(&vertices.z[i]), &ix, &iy, &iz);
+		B nx = B::Load(&normals.x[i]), ny = B::Load(&normals.y[i]), nz = B::Load(&normals.z[i]);
+		B cosIncidenceAngle = FusedMultiplyAdd(ix, nx, FusedMultiplyAdd(iy, ny, iz * nz));
+		reflected += RefractBatch(c, ix, iy, iz, nx, ny, nz, cosIncidenceAngle, c.one - cosIncidenceAngle * cosIncidenceAngle, &rx, &ry, &rz);
+		rx.Store(&refracteds->x[i]);
+		ry.Store(&refracteds->y[i]);
+		rz.Store(&refracteds->z[i]);
+	}
+	return reflected;
+}
+
+template<typename B, typename Scalar>
+static void IntersectKernel(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& refracteds, BasicPointBuffer<Scalar>* intersections, size_t begin, size_t end, double receiver_plane) {
+	const B plane = B::Broadcast(Scalar(receiver_plane));
+	for (size_t i = begin; i + B::width <= end; i += B::width) {
+		B ix, iy;
+		IntersectBatch(plane, B::Load(&vertices.x[i]), B::Load(&vertices.y[i]), B::Load(&vertices.z[i]), B::Load(&refracteds.x[i]), B::Load(&refracteds.y[i]), B::Load(&refracteds.z[i]), &ix, &iy);
+		ix.Store(&intersections->x[i]);
+		iy.Store(&intersections->y[i]);
+	}
+}
 
-	for (int i = 0; i < numPoints; i++) {
-		double cosIncidenceAngle = normals[i].z();	//incident dot normal = 0*Nx + 0*Ny + 1*Nz = Nz
-		double sinRefractedAngle2 = eta * eta * (1 - cosIncidenceAngle * cosIncidenceAngle);	//eta1/eta2 = eta1 = eta, since the second medium is just air with eta2 = 1
-		
-		if (sinRefractedAngle2 <= 1) {		//check for total interal reflection
-			Eigen::Vector3d refracted = eta * incident - (eta * cosIncidenceAngle - sqrtl(1 - sinRefractedAngle2)) * normals[i];
-			refracteds->push_back(refracted);
+template<typename B, typename Scalar>
+static size_t RefractAndIntersectKernel(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& normals, BasicPointBuffer<Scalar>* intersections, size_t begin, size_t end, double eta, double receiver_plane) {	//the refracted direction only ever lives in registers
+	const RefractConstants<B> c(eta);
+	const B plane = B::Broadcast(Scalar(receiver_plane));
+	size_t reflected = 0;
+	for (size_t i = begin; i + B::width <= end; i += B::width) {
+		B rx, ry, rz, ix, iy;
+		reflected += RefractBatch(c, B::Load(&normals.x[i]), B::Load(&normals.y[i]), B::Load(&normals.z[i]), &rx, &ry, &rz);
+		IntersectBatch(plane, B::Load(&vertices.x[i]), B::Load(&vertices.y[i]), B::Load(&vertices.z[i]), rx, ry, rz, &ix, &iy);
+		ix.Store(&intersections->x[i]);
+		iy.Store(&intersections->y[i]);
+	}
+	return reflected;
+}
+
+template<typename Scalar>
+void Refract(const BasicRayBuffer<Scalar>& normals, BasicRayBuffer<Scalar>* refracteds, double eta) {
+	ScopedTimer timer(Stage::Refract);
+	size_t numPoints = normals.size();
+	refracteds->resize(numPoints);
+	GlobalThreadPool().ParallelForRange(numPoints, raysPerChunk, [&](size_t begin, size_t end) {
+		size_t vectorEnd = end - (end - begin) % Batch<Scalar>::width;	//whole batches go through the vector kernel, the leftovers one at a time
+		size_t reflected = RefractKernel<Batch<Scalar>>(normals, refracteds, begin, vectorEnd, eta);
+		reflected += RefractKernel<ScalarBatch<Scalar>>(normals, refracteds, vectorEnd, end, eta);
+		CountRefracted(end - begin, reflected);
+	});
+}
+
+template<typename Scalar>
+void Refract(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& normals, BasicRayBuffer<Scalar>* refracteds, double eta, const Light& light) {
+	if (light.type == Light::Type::Axial) { Refract(normals, refracteds, eta); return; }	//the common case keeps its shortcut
+	ScopedTimer timer(Stage::Refract);
+	size_t numPoints = normals.size();
+	refracteds->resize(numPoints);
+	GlobalThreadPool().ParallelForRange(numPoints, raysPerChunk, [&](size_t begin, size_t end) {
+		size_t vectorEnd = end - (end - begin) % Batch<Scalar>::width;
+		size_t reflected;
+		if (light.type == Light::Type::Directional) {
+			reflected = LitRefractKernel<Batch<Scalar>, DirectionalIncidence<Batch<Scalar>>>(vertices, normals, refracteds, begin, vectorEnd, eta, light);
+			reflected += LitRefractKernel<ScalarBatch<Scalar>, DirectionalIncidence<ScalarBatch<Scalar>>>(vertices, normals, refracteds, vectorEnd, end, eta, light);
+		}
+		else {
+			reflected = LitRefractKernel<Batch<Scalar>, PointIncidence<Batch<Scalar>>>(vertices, normals, refracteds, begin, vectorEnd, eta, light);
+			reflected += LitRefractKernel<ScalarBatch<Scalar>, PointIncidence<ScalarBatch<Scalar>>>(vertices, normals, refracteds, vectorEnd, end, eta, light);
 		}
-		else
-		{
-			refracteds->push_back(TIR);		//out of sight, out of mind :)
-		}									
+		CountRefracted(end - begin, reflected);
+	});
+}
+
+template<typename Scalar>
+void CalculateIntersections(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& refracteds, BasicPointBuffer<Scalar>* intersections, double receiver_plane) {
+	ScopedTimer timer(Stage::Intersect);
+	size_t numPoints = vertices.size();
+	intersections->resize(numPoints);
+	GlobalThreadPool().ParallelForRange(numPoints, raysPerChunk, [&](size_t begin, size_t end) {
+		size_t vectorEnd = end - (end - begin) % Batch<Scalar>::width;
+		IntersectKernel<Batch<Scalar>>(vertices, refracteds, intersections, begin, vectorEnd, receiver_plane);
+		IntersectKernel<ScalarBatch<Scalar>>(vertices, refracteds, intersections, vectorEnd, end, receiver_plane);
+	});
+}
+
+template<typename Scalar>
+void RefractAndIntersect(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& normals, BasicPointBuffer<Scalar>* intersections, double eta, double receiver_plane) {
+	ScopedTimer timer(Stage::Intersect);	//both in one, it goes down as intersecting since that's what it's called in place of
+	size_t numPoints = vertices.size();
+	intersections->resize(numPoints);
+	GlobalThreadPool().ParallelForRange(numPoints, raysPerChunk, [&](size_t begin, size_t end) {
+		size_t vectorEnd = end - (end - begin) % Batch<Scalar>::width;
+		size_t reflected = RefractAndIntersectKernel<Batch<Scalar>>(vertices, normals, intersections, begin, vectorEnd, eta, receiver_plane);
+		reflected += RefractAndIntersectKernel<ScalarBatch<Scalar>>(vertices, normals, intersections, vectorEnd, end, eta, receiver_plane);
+		CountRefracted(end - begin, reflected);
+	});
+}
+
+template<typename B, typename Scalar>
+static void AffineKernel(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& refracteds, BasicAffineIntersections<Scalar>* affine, size_t begin, size_t end) {
+	const B scale = B::Broadcast(128), offset = B::Broadcast(128);
+	for (size_t i = begin; i + B::width <= end; i += B::width) {
+		B vz = B::Load(&vertices.z[i]);
+		B perZ = scale / B::Load(&refracteds.z[i]);
+		B slopeX = B::Load(&refracteds.x[i]) * perZ, slopeY = B::Load(&refracteds.y[i]) * perZ;	//image pixels moved per unit of receiver distance
+		slopeX.Store(&affine->slope.x[i]);
+		slopeY.Store(&affine->slope.y[i]);
+		(FusedMultiplyAdd(B::Load(&vertices.x[i]), scale, offset) - slopeX * vz).Store(&affine->offset.x[i]);	//where the ray would land with the plane at d = 0
+		(FusedMultiplyAdd(B::Load(&vertices.y[i]), scale, offset) - slopeY * vz).Store(&affine->offset.y[i]);
 	}
 }
 
-void CalculateIntersections(std::vector<Eigen::Vector3d> vertices, std::vector<Eigen::Vector3d> refracteds, std::vector<Eigen::Vector2d>* intersections, double receiver_plane) {	//returns the points on the receiver plane where the light rays from each vertex intersect
+template<typename B, typename Scalar>
+static void AffineIntersectKernel(const BasicAffineIntersections<Scalar>& affine, size_t first, BasicPointBuffer<Scalar>* intersections, size_t begin, size_t end, double receiver_plane) {	//intersection i comes from ray first + i
+	const B plane = B::Broadcast(Scalar(receiver_plane));
+	for (size_t i = begin; i + B::width <= end; i += B::width) {
+		size_t ray = first + i;
+		FusedMultiplyAdd(B::Load(&affine.slope.x[ray]), plane, B::Load(&affine.offset.x[ray])).Store(&intersections->x[i]);
+		FusedMultiplyAdd(B::Load(&affine.slope.y[ray]), plane, B::Load(&affine.offset.y[ray])).Store(&intersections->y[i]);
+	}
+}
 
-	intersections->clear();	//clear the intersections every time we call the function 
-	int numPoints = int(vertices.size());
+template<typename Scalar>
+void PrepareAffineIntersections(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& refracteds, BasicAffineIntersections<Scalar>* affine) {
+	ScopedTimer timer(Stage::Refract);	//part of getting the rays ready, it runs once per refraction rather than per frame
+	size_t numPoints = vertices.size();
+	affine->resize(numPoints);
+	GlobalThreadPool().ParallelForRange(numPoints, raysPerChunk, [&](size_t begin, size_t end) {
+		size_t vectorEnd = end - (end - begin) % Batch<Scalar>::width;
+		AffineKernel<Batch<Scalar>>(vertices, refracteds, affine, begin, vectorEnd);
+		AffineKernel<ScalarBatch<Scalar>>(vertices, refracteds, affine, vectorEnd, end);
+	});
+}
+
+template<typename B>
+struct AxialIncidence {	//marks the axial case for kernels that take an incidence, they use the shortcut instead of calling it
+	explicit AxialIncidence(const Light&) {}
+};
+
+template<typename B, typename Incidence, typename Scalar>
+static size_t DispersedAffineKernel(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& normals, std::span<const RefractConstants<B>> constants, const Light& light, std::vector<BasicAffineIntersections<Scalar>>* bands, size_t begin, size_t end) {
+	const B one = B::Broadcast(1), scale = B::Broadcast(128), offset = B::Broadcast(128);
+	const Incidence incidence(light);
+	constexpr bool axial = std::is_same_v<Incidence, AxialIncidence<B>>;
+	size_t reflected = 0;
+	for (size_t i = begin; i + B::width <= end; i += B::width) {	//every band comes out of one load of the ray
+		B nx = B::Load(&normals.x[i]), ny = B::Load(&normals.y[i]), nz = B::Load(&normals.z[i]);
+		B vx = B::Load(&vertices.x[i]), vy = B::Load(&vertices.y[i]), vz = B::Load(&vertices.z[i]);
+		B ix, iy, iz, cosIncidenceAngle = nz;
+		if constexpr (!axial) {
+			incidence(vx, vy, vz, &ix, &iy, &iz);
+			cosIncidenceAngle = FusedMultiplyAdd(ix, nx, FusedMultiplyAdd(iy, ny, iz * nz));
+		}
+		B sinIncidenceAngle2 = one - cosIncidenceAngle * cosIncidenceAngle;	//the only part of the refraction that doesn't depend on the index
+		B imageX = FusedMultiplyAdd(vx, scale, offset), imageY = FusedMultiplyAdd(vy, scale, offset);
+		for (size_t band = 0; band < constants.size(); band++) {
+			B rx, ry, rz;
+			if constexpr (axial) { reflected += RefractBatch(constants[band], nx, ny, nz, sinIncidenceAngle2, &rx, &ry, &rz); }
+			else { reflected += RefractBatch(constants[band], ix, iy, iz, nx, ny, nz, cosIncidenceAngle, sinIncidenceAngle2, &rx, &ry, &rz); }
+			B perZ = scale / rz;
+			B slopeX = rx * perZ, slopeY = ry * perZ;	//same as AffineKernel from here
+			BasicAffineIntersections<Scalar>& affine = (*bands)[band];
+			slopeX.Store(&affine.slope.x[i]);
+			slopeY.Store(&affine.slope.y[i]);
+			(imageX - slopeX * vz).Store(&affine.offset.x[i]);
+			(imageY - slopeY * vz).Store(&affine.offset.y[i]);
+		}
+	}
+	return reflected;
+}
+
+template<template<typename> class Incidence, typename Scalar>
+static void DispersedAffineChunk(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& normals, std::span<const RefractConstants<Batch<Scalar>>> vectorConstants, std::span<const RefractConstants<ScalarBatch<Scalar>>> scalarConstants, const Light& light, std::vector<BasicAffineIntersections<Scalar>>* bands, size_t begin, size_t end) {
+	size_t vectorEnd = end - (end - begin) % Batch<Scalar>::width;
+	size_t reflected = DispersedAffineKernel<Batch<Scalar>, Incidence<Batch<Scalar>>>(vertices, normals, vectorConstants, light, bands, begin, vectorEnd);
+	reflected += DispersedAffineKernel<ScalarBatch<Scalar>, Incidence<ScalarBatch<Scalar>>>(vertices, normals, scalarConstants, light, bands, vectorEnd, end);
+	CountRefracted((end - begin) * vectorConstants.size(), reflected);
+}
+
+template<typename Scalar>
+void PrepareDispersedIntersections(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& normals, std::span<const double> etas, std::vector<BasicAffineIntersections<Scalar>>* bands, const Light& light) {
+	ScopedTimer timer(Stage::Refract);
+	size_t numPoints = vertices.size();
+	bands->resize(etas.size());
+	for (BasicAffineIntersections<Scalar>& affine : *bands) { affine.resize(numPoints); }
+	std::vector<RefractConstants<Batch<Scalar>>> vectorConstants;
+	std::vector<RefractConstants<ScalarBatch<Scalar>>> scalarConstants;
+	for (double eta : etas) {
+		vectorConstants.emplace_back(eta);
+		scalarConstants.emplace_back(eta);
+	}
+	GlobalThreadPool().ParallelForRange(numPoints, raysPerChunk, [&](size_t begin, size_t end) {
+		switch (light.type) {
+		case Light::Type::Axial: DispersedAffineChunk<AxialIncidence>(vertices, normals, std::span<const RefractConstants<Batch<Scalar>>>(vectorConstants), std::span<const RefractConstants<ScalarBatch<Scalar>>>(scalarConstants), light, bands, begin, end); break;
+		case Light::Type::Directional: DispersedAffineChunk<DirectionalIncidence>(vertices, normals, std::span<const RefractConstants<Batch<Scalar>>>(vectorConstants), std::span<const RefractConstants<ScalarBatch<Scalar>>>(scalarConstants), light, bands, begin, end); break;
+		case Light::Type::Point: DispersedAffineChunk<PointIncidence>(vertices, normals, std::span<const RefractConstants<Batch<Scalar>>>(vectorConstants), std::span<const RefractConstants<ScalarBatch<Scalar>>>(scalarConstants), light, bands, begin, end); break;
+		}
+	});
+}
 
-	for (int i = 0; i < numPoints; i++) {
-		double t = (receiver_plane - vertices[i].z()) / refracteds[i].z();	//solve for t in vertex.z + ray.z*t = receiever_plane.z
-		Eigen::Vector2d intersection(vertices[i].x() + refracteds[i].x() * t, vertices[i].y() + refracteds[i].y() * t);
-		intersection = intersection * 128 + Eigen::Vector2d(128, 128); //vertices x,y range between (-1,1), transform to go from (0,256) to match the 256x256 target image
-		intersections->push_back(intersection);
-	}													
+template<typename B>
+struct QuantizedConstants {	//the lens's frame and the octahedral decode, broadcast once per chunk
+	B originX, originY, originZ, scaleX, scaleY, scaleZ, normalScale, one, zero;
+	using Element = typename B::Element;
+	explicit QuantizedConstants(const QuantizedFrame& frame) : originX(B::Broadcast(Element(frame.origin[0]))), originY(B::Broadcast(Element(frame.origin[1]))), originZ(B::Broadcast(Element(frame.origin[2]))),
+		scaleX(B::Broadcast(Element(frame.scale[0]))), scaleY(B::Broadcast(Element(frame.scale[1]))), scaleZ(B::Broadcast(Element(frame.scale[2]))),
+		normalScale(B::Broadcast(Element(1.0 / 32767))), one(B::Broadcast(1)), zero(B::Broadcast(0)) {}
+};
+
+template<typename B, typename Incidence, typename Scalar>
+static size_t QuantizedAffineKernel(const QuantizedLens& lens, const QuantizedConstants<B>& q, const RefractConstants<B>& c, const Light& light, BasicAffineIntersections<Scalar>* affine, size_t begin, size_t end) {	//10 bytes in per ray, the full precision ray only ever lives in registers
+	const B scale = B::Broadcast(128), offset = B::Broadcast(128);
+	const Incidence incidence(light);
+	constexpr bool axial = std::is_same_v<Incidence, AxialIncidence<B>>;
+	size_t reflected = 0;
+	for (size_t i = begin; i + B::width <= end; i += B::width) {
+		B vx = FusedMultiplyAdd(B::LoadWidened(&lens.x[i]), q.scaleX, q.originX);
+		B vy = FusedMultiplyAdd(B::LoadWidened(&lens.y[i]), q.scaleY, q.originY);
+		B vz = FusedMultiplyAdd(B::LoadWidened(&lens.z[i]), q.scaleZ, q.originZ);
+		B nx = FusedMultiplyAdd(B::LoadWidened(&lens.u[i]), q.normalScale, q.zero - q.one);	//octahedral decode, the same steps as DecodeNormal
+		B ny = FusedMultiplyAdd(B::LoadWidened(&lens.v[i]), q.normalScale, q.zero - q.one);
+		B nz = q.one - Max(nx, q.zero - nx) - Max(ny, q.zero - ny);
+		B t = Max(q.zero - nz, q.zero);
+		nx = Select(q.zero <= nx, nx - t, nx + t);
+		ny = Select(q.zero <= ny, ny - t, ny + t);
+		B inverseLength = q.one / Sqrt(FusedMultiplyAdd(nx, nx, FusedMultiplyAdd(ny, ny, nz * nz)));
+		nx = nx * inverseLength;
+		ny = ny * inverseLength;
+		nz = nz * inverseLength;
+
+		B rx, ry, rz;
+		if constexpr (axial) { reflected += RefractBatch(c, nx, ny, nz, &rx, &ry, &rz); }
+		else {
+			B ix, iy, iz;
+			incidence(vx, vy, vz, &ix, &iy, &iz);
+			B cosIncidenceAngle = FusedMultiplyAdd(ix, nx, FusedMultiplyAdd(iy, ny, iz * nz));
+			reflected += RefractBatch(c, ix, iy, iz, nx, ny, nz, cosIncidenceAngle, c.one - cosIncidenceAngle * cosIncidenceAngle, &rx, &ry, &rz);
+		}
+		B perZ = scale / rz;
+		B slopeX = rx * perZ, slopeY = ry * perZ;	//same as AffineKernel from here
+		slopeX.Store(&affine->slope.x[i]);
+		slopeY.Store(&affine->slope.y[i]);
+		(FusedMultiplyAdd(vx, scale, offset) - slopeX * vz).Store(&affine->offset.x[i]);
+		(FusedMultiplyAdd(vy, scale, offset) - slopeY * vz).Store(&affine->offset.y[i]);
+	}
+	return reflected;
+}
+
+template<template<typename> class Incidence, typename Scalar>
+static void QuantizedAffineChunk(const QuantizedLens& lens, double eta, const Light& light, BasicAffineIntersections<Scalar>* affine, size_t begin, size_t end) {
+	size_t vectorEnd = end - (end - begin) % Batch<Scalar>::width;
+	size_t reflected = QuantizedAffineKernel<Batch<Scalar>, Incidence<Batch<Scalar>>>(lens, QuantizedConstants<Batch<Scalar>>(lens.frame), RefractConstants<Batch<Scalar>>(eta), light, affine, begin, vectorEnd);
+	reflected += QuantizedAffineKernel<ScalarBatch<Scalar>, Incidence<ScalarBatch<Scalar>>>(lens, QuantizedConstants<ScalarBatch<Scalar>>(lens.frame), RefractConstants<ScalarBatch<Scalar>>(eta), light, affine, vectorEnd, end);
+	CountRefracted(end - begin, reflected);
+}
+
+template<typename Scalar>
+void PrepareQuantizedIntersections(const QuantizedLens& lens, double eta, const Light& light, BasicAffineIntersections<Scalar>* affine) {
+	ScopedTimer timer(Stage::Refract);
+	affine->resize(lens.size());
+	GlobalThreadPool().ParallelForRange(lens.size(), raysPerChunk, [&](size_t begin, size_t end) {
+		switch (light.type) {
+		case Light::Type::Axial: QuantizedAffineChunk<AxialIncidence>(lens, eta, light, affine, begin, end); break;
+		case Light::Type::Directional: QuantizedAffineChunk<DirectionalIncidence>(lens, eta, light, affine, begin, end); break;
+		case Light::Type::Point: QuantizedAffineChunk<PointIncidence>(lens, eta, light, affine, begin, end); break;
+		}
+	});
+}
+
+//two surface tracing, light comes in through a flat face, crosses the glass and leaves through the obj surface
+//the stages hand each other small blocks of rays in scratch arrays, so tracing a chunk is still a single pass over the lens
+
+const size_t raysPerSlabBlock = 512;	//5 scratch arrays of 512 doubles is 20KB, so everything between the stages stays in L1
+const int entryNewtonSteps = 4;			//for finding where a point light's ray enters, starting from the paraxial answer this is converged to rounding for any sensible setup
+
+template<typename Scalar>
+struct SlabBlock {	//intermediates for one block of rays
+	alignas(64) Scalar entryX[raysPerSlabBlock], entryY[raysPerSlabBlock];	//where the ray crosses the entry face
+	alignas(64) Scalar x[raysPerSlabBlock], y[raysPerSlabBlock], z[raysPerSlabBlock];	//direction inside the glass, then out of it after the exit stage
+};
+
+template<typename B, typename Incidence>
+struct SlabConstants {
+	RefractConstants<B> entry;	//air into glass
+	RefractConstants<B> exit;	//glass into air, same as the single surface kernels
+	Incidence incidence;
+	B entryZ;
+	SlabConstants(double eta, const Light& light, double z) : entry(1 / eta), exit(eta), incidence(light), entryZ(B::Broadcast(typename B::Element(z))) {}
+};
+
+template<typename B, typename Incidence, typename Scalar>
+static void EntryStage(const SlabConstants<B, Incidence>& c, const BasicRayBuffer<Scalar>& vertices, size_t blockBegin, SlabBlock<Scalar>* block, size_t first, size_t last) {	//refract the incoming light at the flat face, whose normal is +z
+	if constexpr (std::is_same_v<Incidence, DirectionalIncidence<B>>) {	//every ray bends the same way, so the direction in the glass is the same for all of them
+		B gx, gy, gz, ix, iy, iz;
+		c.incidence(c.entryZ, c.entryZ, c.entryZ, &ix, &iy, &iz);
+		RefractBatch(c.entry, ix, iy, iz, c.entry.zero, c.entry.zero, c.entry.one, iz, c.entry.one - iz * iz, &gx, &gy, &gz);	//going into the denser medium, so never total internal reflection
+		for (size_t j = first; j + B::width <= last; j += B::width) {
+			gx.Store(&block->x[j]);
+			gy.Store(&block->y[j]);
+			gz.Store(&block->z[j]);
+		}
+	}
+	else {	//a point light's rays each arrive at their own angle, the entry point is where snell's law holds on the line between the feet of the light and the vertex
+		const B one = c.entry.one, zero = c.entry.zero, n = c.exit.eta, tiny = B::Broadcast(typename B::Element(1e-12));
+		for (size_t j = first; j + B::width <= last; j += B::width) {
+			size_t i = blockBegin + j;
+			B dx = B::Load(&vertices.x[i]) - c.incidence.x, dy = B::Load(&vertices.y[i]) - c.incidence.y;
+			B across2 = FusedMultiplyAdd(dx, dx, dy * dy);	//horizontal distance from the light to the vertex, squared
+			B below = c.entryZ - c.incidence.z;				//light to the entry face, has to be positive
+			B inside = B::Load(&vertices.z[i]) - c.entryZ;	//entry face to the vertex
+			B below2 = below * below, inside2 = FusedMultiplyAdd(inside, inside, tiny);	//tiny keeps a vertex sitting right on the face from dividing by zero
+			B s = n * below / FusedMultiplyAdd(n, below, inside);	//fraction of the way across, paraxial guess first
+			for (int step = 0; step < entryNewtonSteps; step++) {	//sin(in) - n*sin(out) is increasing in s, so newton clamped to [0, 1] can't run off
+				B rest = one - s;
+				B toEntry2 = FusedMultiplyAdd(s * s, across2, below2), fromEntry2 = FusedMultiplyAdd(rest * rest, across2, inside2);
+				B inverseToEntry = one / Sqrt(toEntry2), inverseFromEntry = one / Sqrt(fromEntry2);
+				B f = s * inverseToEntry - n * rest * inverseFromEntry;	//both sines divided by the horizontal distance, so this also works with the light right under the vertex
+				B slope = below2 * inverseToEntry * inverseToEntry * inverseToEntry + n * inside2 * inverseFromEntry * inverseFromEntry * inverseFromEntry;
+				s = s - f / slope;
+				s = Max(s, zero);
+				s = Select(s <= one, s, one);
+			}
+			FusedMultiplyAdd(s, dx, c.incidence.x).Store(&block->entryX[j]);
+			FusedMultiplyAdd(s, dy, c.incidence.y).Store(&block->entryY[j]);
+		}
+	}
+}
+
+template<typename B, typename Incidence, typename Scalar>
+static void TransportStage(const SlabConstants<B, Incidence>& c, SlabBlock<Scalar>* block, size_t first, size_t last) {	//bend each point light ray at its entry point, not aimed from the entry point at the vertex since the two coincide for a vertex sitting on the face
+	for (size_t j = first; j + B::width <= last; j += B::width) {
+		B ix, iy, iz, gx, gy, gz;
+		c.incidence(B::Load(&block->entryX[j]), B::Load(&block->entryY[j]), c.entryZ, &ix, &iy, &iz);
+		RefractBatch(c.entry, ix, iy, iz, c.entry.zero, c.entry.zero, c.entry.one, iz, c.entry.one - iz * iz, &gx, &gy, &gz);
+		gx.Store(&block->x[j]);
+		gy.Store(&block->y[j]);
+		gz.Store(&block->z[j]);
+	}
+}
+
+template<typename B, typename Incidence, typename Scalar>
+static size_t ExitStage(const SlabConstants<B, Incidence>& c, const BasicRayBuffer<Scalar>& normals, size_t blockBegin, SlabBlock<Scalar>* block, size_t first, size_t last) {	//refract out through the obj surface, in place, and count the rays that can't get out
+	size_t reflected = 0;
+	for (size_t j = first; j + B::width <= last; j += B::width) {
+		size_t i = blockBegin + j;
+		B gx = B::Load(&block->x[j]), gy = B::Load(&block->y[j]), gz = B::Load(&block->z[j]);
+		B nx = B::Load(&normals.x[i]), ny = B::Load(&normals.y[i]), nz = B::Load(&normals.z[i]);
+		B cosIncidenceAngle = FusedMultiplyAdd(gx, nx, FusedMultiplyAdd(gy, ny, gz * nz));
+		B rx, ry, rz;
+		reflected += RefractBatch(c.exit, gx, gy, gz, nx, ny, nz, cosIncidenceAngle, c.exit.one - cosIncidenceAngle * cosIncidenceAngle, &rx, &ry, &rz);
+		rx.Store(&block->x[j]);
+		ry.Store(&block->y[j]);
+		rz.Store(&block->z[j]);
+	}
+	return reflected;
 }
+
+template<typename B, typename Scalar>
+static void PlaneStage(const BasicRayBuffer<Scalar>& vertices, size_t blockBegin, const SlabBlock<Scalar>& block, BasicAffineIntersections<Scalar>* affine, size_t first, size_t last) {	//same as AffineKernel, with the directions coming from the block
+	const B scale = B::Broadcast(128), offset = B::Broadcast(128);
+	for (size_t j = first; j + B::width <= last; j += B::width) {
+		size_t i = blockBegin + j;
+		B vz = B::Load(&vertices.z[i]);
+		B perZ = scale / B::Load(&block.z[j]);
+		B slopeX = B::Load(&block.x[j]) * perZ, slopeY = B::Load(&block.y[j]) * perZ;
+		slopeX.Store(&affine->slope.x[i]);
+		slopeY.Store(&affine->slope.y[i]);
+		(FusedMultiplyAdd(B::Load(&vertices.x[i]), scale, offset) - slopeX * vz).Store(&affine->offset.x[i]);
+		(FusedMultiplyAdd(B::Load(&vertices.y[i]), scale, offset) - slopeY * vz).Store(&affine->offset.y[i]);
+	}
+}
+
+template<typename B, typename Incidence, typename Scalar>
+static size_t TraceSlabBlock(const SlabConstants<B, Incidence>& c, const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& normals, BasicAffineIntersections<Scalar>* affine, size_t blockBegin, SlabBlock<Scalar>* block, size_t first, size_t last) {
+	EntryStage(c, vertices, blockBegin, block, first, last);
+	if constexpr (std::is_same_v<Incidence, PointIncidence<B>>) { TransportStage(c, block, first, last); }	//collimated light already has its direction in the glass
+	size_t reflected = ExitStage(c, normals, blockBegin, block, first, last);	//going in through the flat face from air never reflects
+	PlaneStage<B>(vertices, blockBegin, *block, affine, first, last);
+	return reflected;
+}
+
+template<template<typename> class Incidence, typename Scalar>
+static void TraceSlabChunk(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& normals, BasicAffineIntersections<Scalar>* affine, double eta, const Light& light, double entryPlane, size_t begin, size_t end) {
+	const SlabConstants<Batch<Scalar>, Incidence<Batch<Scalar>>> vectorConstants(eta, light, entryPlane);
+	const SlabConstants<ScalarBatch<Scalar>, Incidence<ScalarBatch<Scalar>>> scalarConstants(eta, light, entryPlane);
+	SlabBlock<Scalar> block;
+	size_t reflected = 0;
+	for (size_t blockBegin = begin; blockBegin < end; blockBegin += raysPerSlabBlock) {
+		size_t count = std::min(raysPerSlabBlock, end - blockBegin);
+		size_t vectorCount = count - count % Batch<Scalar>::width;
+		reflected += TraceSlabBlock(vectorConstants, vertices, normals, affine, blockBegin, &block, 0, vectorCount);
+		reflected += TraceSlabBlock(scalarConstants, vertices, normals, affine, blockBegin, &block, vectorCount, count);
+	}
+	CountRefracted(end - begin, reflected);
+}
+
+template<typename Scalar>
+void TraceSlab(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& normals, BasicAffineIntersections<Scalar>* affine, double eta, const Light& light, double thickness) {
+	ScopedTimer timer(Stage::Refract);
+	size_t numPoints = vertices.size();
+	if (light.type == Light::Type::Axial) {	//straight on through a flat face doesn't bend at all, so it's just the single surface case
+		BasicRayBuffer<Scalar> refracteds;
+		Refract(normals, &refracteds, eta);
+		PrepareAffineIntersections(vertices, refracteds, affine);
+		return;
+	}
+
+	double lowest = 0;	//the entry face sits thickness below the lowest point of the obj surface
+	if (numPoints > 0) { lowest = double(*std::min_element(vertices.z.begin(), vertices.z.end())); }
+	double entryPlane = lowest - thickness;
+	affine->resize(numPoints);
+	GlobalThreadPool().ParallelForRange(numPoints, raysPerChunk, [&](size_t begin, size_t end) {
+		if (light.type == Light::Type::Directional) { TraceSlabChunk<DirectionalIncidence>(vertices, normals, affine, eta, light, entryPlane, begin, end); }
+		else { TraceSlabChunk<PointIncidence>(vertices, normals, affine, eta, light, entryPlane, begin, end); }
+	});
+}
+
+template<typename Scalar>
+void CalculateIntersections(const BasicAffineIntersections<Scalar>& affine, BasicPointBuffer<Scalar>* intersections, double receiver_plane) {
+	CalculateIntersections(affine, 0, affine.size(), intersections, receiver_plane);
+}
+
+template<typename Scalar>
+void CalculateIntersections(const BasicAffineIntersections<Scalar>& affine, size_t first, size_t last, BasicPointBuffer<Scalar>* intersections, double receiver_plane) {
+	ScopedTimer timer(Stage::Intersect);
+	size_t numPoints = last - first;
+	intersections->resize(numPoints);
+	GlobalThreadPool().ParallelForRange(numPoints, raysPerChunk, [&](size_t begin, size_t end) {
+		size_t vectorEnd = end - (end - begin) % Batch<Scalar>::width;
+		AffineIntersectKernel<Batch<Scalar>>(affine, first, intersections, begin, vectorEnd, receiver_plane);
+		AffineIntersectKernel<ScalarBatch<Scalar>>(affine, first, intersections, vectorEnd, end, receiver_plane);
+	});
+}
+
+const double compactionMargin = 1;	//in image units, so rays right on the edge aren't lost to rounding between this test and the splat
+
+template<typename Scalar>
+static bool MayLand(Scalar offset, Scalar slope, double nearPlane, double farPlane) {	//the hit moves in a straight line with the distance, so it passes through the image somewhere in the range iff the segment between the two ends overlaps it
+	double a = double(offset) + nearPlane * double(slope), b = double(offset) + farPlane * double(slope);
+	return std::min(a, b) < 256 + compactionMargin && std::max(a, b) >= -compactionMargin;	//false for NaNs, which never land anyway
+}
+
+template<typename Scalar>
+static bool MayLand(const BasicAffineIntersections<Scalar>& affine, size_t i, double nearPlane, double farPlane) {
+	return MayLand(affine.offset.x[i], affine.slope.x[i], nearPlane, farPlane) && MayLand(affine.offset.y[i], affine.slope.y[i], nearPlane, farPlane);	//only a bounding box test, a ray that clips a corner in x and y at different distances stays in, which is safe
+}
+
+size_t PreviewLevelEnd(size_t numRays, int level) { return (numRays + previewStrides[level] - 1) / previewStrides[level]; }
+
+static size_t PreviewPosition(size_t j, size_t numRays) {	//where the j'th survivor goes, after all the levels before its own and after the rays of its level that come before it
+	int level = 0;
+	while (j % previewStrides[level] != 0) { level++; }	//the last stride is 1, so this always stops
+	size_t before = level == 0 ? 0 : PreviewLevelEnd(numRays, level - 1);
+	size_t coarser = level == 0 ? 0 : (j + previewStrides[level - 1] - 1) / previewStrides[level - 1];	//rays before j that belong to an earlier level
+	return before + (j + previewStrides[level] - 1) / previewStrides[level] - coarser;
+}
+
+template<typename Scalar>
+void CompactIntersections(const BasicAffineIntersections<Scalar>& affine, double nearPlane, double farPlane, BasicAffineIntersections<Scalar>* active) {
+	ScopedTimer timer(Stage::Refract);	//like the affine setup, it's paid once per index rather than per frame
+	size_t numRays = affine.size();
+	size_t numChunks = (numRays + raysPerChunk - 1) / raysPerChunk;
+	std::vector<size_t> chunkOffsets(numChunks + 1, 0);
+	ThreadPool& pool = GlobalThreadPool();
+	pool.ParallelForRange(numRays, raysPerChunk, [&](size_t begin, size_t end) {	//count, then a prefix sum over the chunks, then every chunk writes its survivors into its own slice
+		size_t count = 0;
+		for (size_t i = begin; i < end; i++) { count += MayLand(affine, i, nearPlane, farPlane); }
+		chunkOffsets[begin / raysPerChunk + 1] = count;
+	});
+	for (size_t chunk = 0; chunk < numChunks; chunk++) { chunkOffsets[chunk + 1] += chunkOffsets[chunk]; }
+	active->resize(chunkOffsets[numChunks]);
+	pool.ParallelForRange(numRays, raysPerChunk, [&](size_t begin, size_t end) {	//testing again is cheaper than keeping a flag per ray around between the passes
+		size_t j = chunkOffsets[begin / raysPerChunk], numActive = chunkOffsets[numChunks];
+		for (size_t i = begin; i < end; i++) {
+			if (!MayLand(affine, i, nearPlane, farPlane)) { continue; }
+			size_t k = PreviewPosition(j, numActive);
+			active->offset.x[k] = affine.offset.x[i];
+			active->offset.y[k] = affine.offset.y[i];
+			active->slope.x[k] = affine.slope.x[i];
+			active->slope.y[k] = affine.slope.y[i];
+			j++;
+		}
+	});
+}
+
+//supersampling, extra rays spread over the faces with their normals interpolated between the corners
+//they're made a block at a time into scratch arrays and go straight to the affine form, so only the caller's batch of results ever takes up memory
+
+const size_t raysPerSampleBlock = 512;	//6 scratch arrays of 512 doubles is 24KB, same idea as the slab blocks
+const double sampleStepU = 0.7548776662466927, sampleStepV = 0.5698402909980532;	//the R2 sequence, consecutive samples spread evenly over the square instead of clumping like independent random ones
+
+template<typename Scalar>
+struct SampleBlock {	//interpolated position and normal of each sample
+	alignas(64) Scalar x[raysPerSampleBlock], y[raysPerSampleBlock], z[raysPerSampleBlock];
+	alignas(64) Scalar nx[raysPerSampleBlock], ny[raysPerSampleBlock], nz[raysPerSampleBlock];
+};
+
+static double SampleRotation(uint64_t h) {	//murmur3 finalizer down to [0, 1), gives each triangle its own offset into the sequence
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return double(h >> 11) * 0x1.0p-53;
+}
+
+template<typename Scalar>
+static void GenerateSamples(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& normals, std::span<const Triangle> triangles, size_t samplesPerTriangle, uint64_t seed, size_t firstSample, size_t count, SampleBlock<Scalar>* block) {
+	size_t t = firstSample / samplesPerTriangle, k = firstSample % samplesPerTriangle;
+	double rotationU = 0, rotationV = 0;
+	for (size_t j = 0; j < count; j++, k++) {
+		if (k == samplesPerTriangle) { k = 0; t++; }
+		const Triangle& triangle = triangles[t];
+		if (j == 0 || k == 0) {	//keyed on the corners rather than the position in the list, so the pattern doesn't depend on how the triangles were split between threads
+			uint64_t key = seed ^ (uint64_t(triangle.vertices[0]) * 0x9e3779b97f4a7c15ULL) ^ (uint64_t(triangle.vertices[1]) << 21) ^ (uint64_t(triangle.vertices[2]) << 42);
+			rotationU = SampleRotation(key);
+			rotationV = SampleRotation(key ^ 0x5bd1e9955bd1e995ULL);
+		}
+		double u = rotationU + double(k) * sampleStepU, v = rotationV + double(k) * sampleStepV;
+		u -= std::floor(u);
+		v -= std::floor(v);
+		if (u + v > 1) { u = 1 - u; v = 1 - v; }	//fold the far half of the square back onto the triangle, which keeps the samples uniform over its area
+		Scalar b0 = Scalar(1 - u - v), b1 = Scalar(u), b2 = Scalar(v);
+		uint32_t a = triangle.vertices[0], b = triangle.vertices[1], c = triangle.vertices[2];
+		block->x[j] = b0 * vertices.x[a] + b1 * vertices.x[b] + b2 * vertices.x[c];
+		block->y[j] = b0 * vertices.y[a] + b1 * vertices.y[b] + b2 * vertices.y[c];
+		block->z[j] = b0 * vertices.z[a] + b1 * vertices.z[b] + b2 * vertices.z[c];
+		a = triangle.normals[0]; b = triangle.normals[1]; c = triangle.normals[2];
+		block->nx[j] = b0 * normals.x[a] + b1 * normals.x[b] + b2 * normals.x[c];	//normalized in the kernel, a batch at a time
+		block->ny[j] = b0 * normals.y[a] + b1 * normals.y[b] + b2 * normals.y[c];
+		block->nz[j] = b0 * normals.z[a] + b1 * normals.z[b] + b2 * normals.z[c];
+	}
+}
+
+template<typename B, typename Incidence, typename Scalar>
+static size_t SampleAffineKernel(const SampleBlock<Scalar>& block, const RefractConstants<B>& c, const Incidence& incidence, BasicAffineIntersections<Scalar>* affine, size_t outputBegin, size_t first, size_t last) {
+	const B scale = B::Broadcast(128), offset = B::Broadcast(128);
+	constexpr bool axial = std::is_same_v<Incidence, AxialIncidence<B>>;
+	size_t reflected = 0;
+	for (size_t j = first; j + B::width <= last; j += B::width) {
+		B nx = B::Load(&block.nx[j]), ny = B::Load(&block.ny[j]), nz = B::Load(&block.nz[j]);
+		B inverseLength = c.one / Sqrt(FusedMultiplyAdd(nx, nx, FusedMultiplyAdd(ny, ny, nz * nz)));	//blending unit normals shortens them
+		nx = nx * inverseLength;
+		ny = ny * inverseLength;
+		nz = nz * inverseLength;
+		B vx = B::Load(&block.x[j]), vy = B::Load(&block.y[j]), vz = B::Load(&block.z[j]);
+		B rx, ry, rz;
+		if constexpr (axial) { reflected += RefractBatch(c, nx, ny, nz, &rx, &ry, &rz); }
+		else {
+			B ix, iy, iz;
+			incidence(vx, vy, vz, &ix, &iy, &iz);
+			B cosIncidenceAngle = FusedMultiplyAdd(ix, nx, FusedMultiplyAdd(iy, ny, iz * nz));
+			reflected += RefractBatch(c, ix, iy, iz, nx, ny, nz, cosIncidenceAngle, c.one - cosIncidenceAngle * cosIncidenceAngle, &rx, &ry, &rz);
+		}
+		B perZ = scale / rz;
+		B slopeX = rx * perZ, slopeY = ry * perZ;	//same as AffineKernel from here
+		size_t i = outputBegin + j;
+		slopeX.Store(&affine->slope.x[i]);
+		slopeY.Store(&affine->slope.y[i]);
+		(FusedMultiplyAdd(vx, scale, offset) - slopeX * vz).Store(&affine->offset.x[i]);
+		(FusedMultiplyAdd(vy, scale, offset) - slopeY * vz).Store(&affine->offset.y[i]);
+	}
+	return reflected;
+}
+
+template<template<typename> class Incidence, typename Scalar>
+static void SampleTriangles(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& normals, std::span<const Triangle> triangles, size_t samplesPerTriangle, uint64_t seed, double eta, const Light& light, BasicAffineIntersections<Scalar>* affine) {
+	const RefractConstants<Batch<Scalar>> vectorConstants(eta);
+	const RefractConstants<ScalarBatch<Scalar>> scalarConstants(eta);
+	const Incidence<Batch<Scalar>> vectorIncidence(light);
+	const Incidence<ScalarBatch<Scalar>> scalarIncidence(light);
+	SampleBlock<Scalar> block;
+	size_t numSamples = affine->size(), reflected = 0;
+	for (size_t blockBegin = 0; blockBegin < numSamples; blockBegin += raysPerSampleBlock) {
+		size_t count = std::min(raysPerSampleBlock, numSamples - blockBegin);
+		size_t vectorCount = count - count % Batch<Scalar>::width;
+		GenerateSamples(vertices, normals, triangles, samplesPerTriangle, seed, blockBegin, count, &block);
+		reflected += SampleAffineKernel(block, vectorConstants, vectorIncidence, affine, blockBegin, 0, vectorCount);
+		reflected += SampleAffineKernel(block, scalarConstants, scalarIncidence, affine, blockBegin, vectorCount, count);
+	}
+	CountRefracted(numSamples, reflected);
+}
+
+template<typename Scalar>
+void PrepareSampledIntersections(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& normals, std::span<const Triangle> triangles, int samplesPerTriangle, double eta, const Light& light, BasicAffineIntersections<Scalar>* affine, uint64_t seed) {
+	size_t perTriangle = size_t(std::max(samplesPerTriangle, 1));
+	affine->resize(triangles.size() * perTriangle);
+	switch (light.type) {
+	case Light::Type::Axial: SampleTriangles<AxialIncidence>(vertices, normals, triangles, perTriangle, seed, eta, light, affine); break;
+	case Light::Type::Directional: SampleTriangles<DirectionalIncidence>(vertices, normals, triangles, perTriangle, seed, eta, light, affine); break;
+	case Light::Type::Point: SampleTriangles<PointIncidence>(vertices, normals, triangles, perTriangle, seed, eta, light, affine); break;
+	}
+}
+
+PrecisionReport ValidatePrecision(std::span<const Eigen::Vector3d> vertices, std::span<const Eigen::Vector3d> normals, double eta, double receiver_plane) {	//runs the lens through the solver in both precisions and compares where the rays land
+	BasicRayBuffer<double> doubleVertices, doubleNormals;
+	BasicPointBuffer<double> reference;
+	ToRayBuffer(vertices, &doubleVertices);
+	ToRayBuffer(normals, &doubleNormals);
+	RefractAndIntersect(doubleVertices, doubleNormals, &reference, eta, receiver_plane);	//one-shot, so there's no point keeping the refracted directions around
+
+	BasicRayBuffer<float> floatVertices, floatNormals;
+	BasicPointBuffer<float> test;
+	ToRayBuffer(vertices, &floatVertices);
+	ToRayBuffer(normals, &floatNormals);
+	RefractAndIntersect(floatVertices, floatNormals, &test, eta, receiver_plane);
+
+	PrecisionReport report;
+	for (size_t i = 0; i < reference.size(); i++) {
+		bool referenceOnScreen = reference.x[i] >= 0 && reference.x[i] < 256 && reference.y[i] >= 0 && reference.y[i] < 256;
+		bool testOnScreen = test.x[i] >= 0 && test.x[i] < 256 && test.y[i] >= 0 && test.y[i] < 256;
+		if (!referenceOnScreen && !testOnScreen) { continue; }	//rays that miss the image in both precisions can't change it, that includes every total internal reflection
+		report.raysCompared++;
+		double deviation = std::max(std::abs(test.x[i] - reference.x[i]), std::abs(test.y[i] - reference.y[i]));
+		report.maxPixelDeviation = std::max(report.maxPixelDeviation, deviation);
+		if (std::floor(test.x[i]) != std::floor(reference.x[i]) || std::floor(test.y[i]) != std::floor(reference.y[i])) { report.raysChangedPixel++; }
+	}
+	return report;
+}
+
+template size_t ReadLensBlock(LensStream*, size_t, BasicRayBuffer<float>*, BasicRayBuffer<float>*);
+template size_t ReadLensBlock(LensStream*, size_t, BasicRayBuffer<double>*, BasicRayBuffer<double>*);
+template void ToRayBuffer(std::span<const Eigen::Vector3d>, BasicRayBuffer<float>*);
+template void ToRayBuffer(std::span<const Eigen::Vector3d>, BasicRayBuffer<double>*);
+template void Refract(const BasicRayBuffer<float>&, BasicRayBuffer<float>*, double);
+template void Refract(const BasicRayBuffer<double>&, BasicRayBuffer<double>*, double);
+template void CalculateIntersections(const BasicRayBuffer<float>&, const BasicRayBuffer<float>&, BasicPointBuffer<float>*, double);
+template void CalculateIntersections(const BasicRayBuffer<double>&, const BasicRayBuffer<double>&, BasicPointBuffer<double>*, double);
+template void RefractAndIntersect(const BasicRayBuffer<float>&, const BasicRayBuffer<float>&, BasicPointBuffer<float>*, double, double);
+template void RefractAndIntersect(const BasicRayBuffer<double>&, const BasicRayBuffer<double>&, BasicPointBuffer<double>*, double, double);
+template void PrepareAffineIntersections(const BasicRayBuffer<float>&, const BasicRayBuffer<float>&, BasicAffineIntersections<float>*);
+template void PrepareAffineIntersections(const BasicRayBuffer<double>&, const BasicRayBuffer<double>&, BasicAffineIntersections<double>*);
+template void CalculateIntersections(const BasicAffineIntersections<float>&, BasicPointBuffer<float>*, double);
+template void CalculateIntersections(const BasicAffineIntersections<double>&, BasicPointBuffer<double>*, double);
+template void CalculateIntersections(const BasicAffineIntersections<float>&, size_t, size_t, BasicPointBuffer<float>*, double);
+template void CalculateIntersections(const BasicAffineIntersections<double>&, size_t, size_t, BasicPointBuffer<double>*, double);
+template void CompactIntersections(const BasicAffineIntersections<float>&, double, double, BasicAffineIntersections<float>*);
+template void CompactIntersections(const BasicAffineIntersections<double>&, double, double, BasicAffineIntersections<double>*);
+template void Refract(const BasicRayBuffer<float>&, const BasicRayBuffer<float>&, BasicRayBuffer<float>*, double, const Light&);
+template void Refract(const BasicRayBuffer<double>&, const BasicRayBuffer<double>&, BasicRayBuffer<double>*, double, const Light&);
+template void PrepareDispersedIntersections(const BasicRayBuffer<float>&, const BasicRayBuffer<float>&, std::span<const double>, std::vector<BasicAffineIntersections<float>>*, const Light&);
+template void PrepareDispersedIntersections(const BasicRayBuffer<double>&, const BasicRayBuffer<double>&, std::span<const double>, std::vector<BasicAffineIntersections<double>>*, const Light&);
+template void PrepareQuantizedIntersections(const QuantizedLens&, double, const Light&, BasicAffineIntersections<float>*);
+template void PrepareQuantizedIntersections(const QuantizedLens&, double, const Light&, BasicAffineIntersections<double>*);
+template void TraceSlab(const BasicRayBuffer<float>&, const BasicRayBuffer<float>&, BasicAffineIntersections<float>*, double, const Light&, double);
+template void TraceSlab(const BasicRayBuffer<double>&, const BasicRayBuffer<double>&, BasicAffineIntersections<double>*, double, const Light&, double);
+template void PrepareSampledIntersections(const BasicRayBuffer<float>&, const BasicRayBuffer<float>&, std::span<const Triangle>, int, double, const Light&, BasicAffineIntersections<float>*, uint64_t);
+template void PrepareSampledIntersections(const BasicRayBuffer<double>&, const BasicRayBuffer<double>&, std::span<const Triangle>, int, double, const Light&, BasicAffineIntersections<double>*, uint64_t);
@@ -1,12 +1,153 @@
 #pragma once
+#include <cstdint>
 #include <iostream>
 #include <fstream>
+#include <span>
 #include <string>
 #include <vector>
 #include "Eigen/Core"
+#include "lenscache.h"
+#include "quantize.h"
+#include "raybuffer.h"
 
-void ParseOBJ(std::string objFilePath, std::vector<Eigen::Vector3d>* vertices, std::vector<Eigen::Vector3d>* normals);
+//inputs are taken as read-only spans so they can come from std::vectors or straight from a mapped .lensbin without copying
+//outputs are resized to match the inputs and overwritten, so reusing the same output vector between calls never allocates
 
-void Refract(std::vector<Eigen::Vector3d> normals, std::vector<Eigen::Vector3d>* refracteds, double n);
+struct Lens {	//vertices, normals and faces of a lens, pointing either into a mapped .lensbin or into the parsed arrays below
+	std::span<const Eigen::Vector3d> vertices;
+	std::span<const Eigen::Vector3d> normals;
+	std::span<const Triangle> triangles;
+	LensCache cache;
+	std::vector<Eigen::Vector3d> parsedVertices;
+	std::vector<Eigen::Vector3d> parsedNormals;
+	std::vector<Triangle> parsedTriangles;
+	uint64_t hash = 0;	//content hash of the .obj, for telling lenses apart in anything cached per lens
+};
 
-void CalculateIntersections(std::vector<Eigen::Vector3d> vertices, std::vector<Eigen::Vector3d> refracteds, std::vector<Eigen::Vector2d>* intersections, double d);
+void ParseOBJ(const std::string& objFilePath, std::vector<Eigen::Vector3d>* vertices, std::vector<Eigen::Vector3d>* normals, bool useLensCache = false, std::vector<Triangle>* triangles = nullptr);	//with useLensCache, reads the .lensbin sidecar next to the .obj if it's up to date and writes one if not
+//every v and vn record counts wherever it sits in the file, vt lines in between included, with triangles it reads the f records too, their indices count from the first vertex and normal this file adds
+
+void LoadLens(const std::string& objFilePath, Lens* lens, VertexOrder order = VertexOrder::File, bool writeCache = true);	//maps the lens straight from the .lensbin for the order asked for if that's up to date, otherwise reorders the file order cache or parses the .obj, and writes what it made unless told not to
+//VertexOrder::Hilbert reorders the lens along a Hilbert curve before caching it, a file order cache is reordered without parsing again, a lens whose normals don't pair up with its vertices stays in file order
+
+struct LensStream {	//a lens read a block of rays at a time so it never has to fit in memory, from its .lensbin when that's up to date or else straight from the .obj text
+	LensCache cache;
+	bool fromCache = false;
+	size_t position = 0;				//pairs handed out of the cache so far
+	MappedFile file;					//the .obj, when there's no usable cache
+	const char* nextVertexLine = nullptr;	//the v and vn records are read with a cursor each, since files list all of one before the other
+	const char* nextNormalLine = nullptr;
+	std::vector<Eigen::Vector3d> pendingVertices;	//parsed but not handed out yet, a malformed line on one side leaves the other a few ahead
+	std::vector<Eigen::Vector3d> pendingNormals;
+	std::vector<const char*> lines;		//scratch, the line starts of the records being parsed
+	size_t malformedLines = 0;			//skipped so far
+	size_t remaining = SIZE_MAX;		//rays left to hand out, a shard's worth when it was opened with OpenLensShard
+};
+
+bool OpenLensStream(const std::string& objFilePath, LensStream* stream);	//false if neither the cache nor the .obj can be read, never writes a cache since that would mean holding the whole lens
+
+template<typename Scalar>
+size_t ReadLensBlock(LensStream* stream, size_t maxRays, BasicRayBuffer<Scalar>* vertices, BasicRayBuffer<Scalar>* normals);	//the next up to maxRays vertex and normal pairs, 0 once either runs out
+//the text is read the way ParseOBJ reads it, every v and vn record wherever it sits and malformed ones skipped, so vertex i still pairs with normal i and the rays match a cached read
+
+struct LensShard {	//one node's share of a lens for distributed rendering, as byte offsets into whichever file the stream reads
+	uint64_t vertexOffset = 0;	//of its first v record in the .obj, or of its first vertex in the .lensbin
+	uint64_t normalOffset = 0;
+	uint64_t numRays = 0;
+};
+
+struct LensShardPlan {
+	bool fromCache = false;		//offsets into the .lensbin, otherwise into the .obj
+	uint64_t sourceSize = 0;	//of the file the offsets are into, so a node looking at a different one can tell
+	uint64_t sourceHash = 0;	//the cache's hash of the .obj, 0 for the text
+	std::vector<LensShard> shards;
+};
+
+bool PlanLensShards(const std::string& objFilePath, size_t numShards, LensShardPlan* plan);	//even splits of the ray pairs, straight from the header of an up to date cache, otherwise from one scan over the line starts of the .obj
+//the split counts records rather than the rays that parse, so a malformed line shifts the pairing within its shard differently from a single StreamingSweep, a clean file gives exactly the same rays
+
+bool OpenLensShard(const std::string& objFilePath, const LensShardPlan& plan, size_t shard, LensStream* stream);	//a stream that hands out only that shard's rays, false if this node's copy of the lens doesn't match the plan
+
+struct Light {	//where the light comes from, every kernel assumes axial light unless it's given one of these
+	enum class Type { Axial, Directional, Point };
+	Type type = Type::Axial;				//axial is collimated light travelling along +z, which the kernels special case
+	Eigen::Vector3d direction{ 0, 0, 1 };	//for directional light, the direction it travels in, doesn't need to be normalized
+	Eigen::Vector3d position{ 0, 0, -1 };	//for a point light, in the same coordinates as the lens
+
+	bool operator==(const Light& other) const { return type == other.type && direction == other.direction && position == other.position; }
+};
+
+void Refract(std::span<const Eigen::Vector3d> normals, std::vector<Eigen::Vector3d>* refracteds, double n);
+
+void CalculateIntersections(std::span<const Eigen::Vector3d> vertices, std::span<const Eigen::Vector3d> refracteds, std::vector<Eigen::Vector2d>* intersections, double d);
+
+//structure of arrays versions of the two above, these are the ones to use for anything big, they run several rays per instruction using whatever vector extensions the build enables
+//both are instantiated for float and double buffers, RayBuffer and PointBuffer pick the one the build is set to
+
+template<typename Scalar>
+void Refract(const BasicRayBuffer<Scalar>& normals, BasicRayBuffer<Scalar>* refracteds, double n);
+
+template<typename Scalar>
+void Refract(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& normals, BasicRayBuffer<Scalar>* refracteds, double n, const Light& light);	//for any light, point lights need the vertices to know where each ray comes from, axial light goes through the version above
+
+template<typename Scalar>
+void CalculateIntersections(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& refracteds, BasicPointBuffer<Scalar>* intersections, double d);
+
+template<typename Scalar>
+void RefractAndIntersect(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& normals, BasicPointBuffer<Scalar>* intersections, double n, double d);	//both of the above in one pass without ever storing the refracted directions, for one-off renders where the plane doesn't move
+
+template<typename Scalar>
+void PrepareAffineIntersections(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& refracteds, BasicAffineIntersections<Scalar>* affine);	//precomputes each ray's offset and slope once per refraction
+
+template<typename Scalar>
+void CalculateIntersections(const BasicAffineIntersections<Scalar>& affine, BasicPointBuffer<Scalar>* intersections, double d);	//one fused multiply-add per component per ray, evaluated from scratch every call so nothing drifts however often the plane moves
+
+template<typename Scalar>
+void CalculateIntersections(const BasicAffineIntersections<Scalar>& affine, size_t first, size_t last, BasicPointBuffer<Scalar>* intersections, double d);	//the same for rays [first, last) only, intersections gets last - first points
+
+const int previewLevels = 3;
+const size_t previewStrides[previewLevels] = { 64, 16, 1 };	//each has to divide the one before, the last has to be 1
+size_t PreviewLevelEnd(size_t numRays, int level);	//rays [0, PreviewLevelEnd) of a compacted buffer are an even 1 in previewStrides[level] sample of all of them
+
+template<typename Scalar>
+void CompactIntersections(const BasicAffineIntersections<Scalar>& affine, double nearPlane, double farPlane, BasicAffineIntersections<Scalar>* active);	//copies out just the rays that can land in the 256x256 image for some receiver distance in [nearPlane, farPlane]
+//the rest, total internal reflections included, can't change any image in that range, so intersecting and splatting active instead gives the same pictures for less work
+//in preview order, every 64th survivor first, then the rest of every 16th, then the others, each group keeping the order the rays were in, so every PreviewLevelEnd prefix is a coarse image of the whole lens
+
+template<typename Scalar>
+void PrepareDispersedIntersections(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& normals, std::span<const double> n, std::vector<BasicAffineIntersections<Scalar>>* bands, const Light& light = Light());	//refraction and affine setup for several indices in one pass, the loads and the incidence angle are shared, bands gets one entry per index
+
+template<typename Scalar>
+void PrepareQuantizedIntersections(const QuantizedLens& lens, double n, const Light& light, BasicAffineIntersections<Scalar>* affine);	//refraction and affine setup straight from the quantized lens, decoding each ray as it's loaded, for any light
+//the same as Refract then PrepareAffineIntersections on DecodeVertex and DecodeNormal of every ray, up to the rounding of the build's precision
+
+template<typename Scalar>
+void TraceSlab(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& normals, BasicAffineIntersections<Scalar>* affine, double n, const Light& light, double thickness);	//the lens as a slab of glass, light refracts in through a flat face thickness below the lowest vertex, crosses the glass, and refracts out through the obj surface, straight to the affine form, a point light has to be below the entry face
+
+template<typename Scalar>
+void PrepareSampledIntersections(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& normals, std::span<const Triangle> triangles, int samplesPerTriangle, double n, const Light& light, BasicAffineIntersections<Scalar>* affine, uint64_t seed = 0);	//samplesPerTriangle jittered rays over each triangle with their normals interpolated, straight to the affine form in triangle order
+//runs on the calling thread, it's meant to be called from each task on a small batch of triangles so the rays never all exist at once, the jitter only depends on the seed and each triangle's corners
+
+struct PrecisionReport {	//how far single precision intersections land from the double precision reference, in pixels of the 256x256 image
+	double maxPixelDeviation = 0;
+	size_t raysCompared = 0;	//rays that land on the image in at least one of the two precisions
+	size_t raysChangedPixel = 0;	//rays that land in a different pixel in single precision
+};
+
+PrecisionReport ValidatePrecision(std::span<const Eigen::Vector3d> vertices, std::span<const Eigen::Vector3d> normals, double eta, double d);	//tells you whether a lens is safe to run in single precision, regardless of which precision the build uses
+
+#ifdef CAUSTICS_GPU
+//the same two stages on the gpu through OpenGL 4.3 compute shaders, the rays stay resident on the device and the histogram is drawn straight into the window
+//everything here has to be called on the thread that owns the current GL context
+
+struct GPURays;
+
+GPURays* CreateGPURays(const RayBuffer& vertices, const RayBuffer& normals);	//uploads the lens, returns nullptr if the context can't run the compute shaders
+void DestroyGPURays(GPURays* rays);
+
+void Refract(GPURays* rays, double n);
+
+void CalculateIntersections(GPURays* rays, double d, int width, int height);	//splats the hits into a width x height histogram on the device instead of handing back points
+
+void PresentIrradiance(GPURays* rays, int drawableWidth, int drawableHeight);	//tone maps the histogram into the current framebuffer, stretched to fill it, the caller swaps
+#endif
@@ -0,0 +1,58 @@
+#include "refractioncache.h"
+
+#include <cmath>
+
+const double activeWindow = 1;	//how far the plane can move either way before the active rays are compacted again, ten presses of W or S
+
+const AffineIntersections& RefractionCache::Active(Entry* entry, double receiverPlane) {
+	if (receiverPlane < entry->activeNear || receiverPlane > entry->activeFar) {
+		entry->activeNear = receiverPlane - activeWindow;
+		entry->activeFar = receiverPlane + activeWindow;
+		CompactIntersections(entry->affine, entry->activeNear, entry->activeFar, &entry->active);
+		version++;
+	}
+	return entry->active;
+}
+
+RefractionCache::Entry* RefractionCache::Find(uint64_t lensHash, double eta, const Light& light, double slabThickness) {
+	for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
+		if (entry->lensHash == lensHash && std::abs(entry->eta - eta) < 1e-9 && entry->light == light && entry->slabThickness == slabThickness) {	//so nudging the index up and back down again still hits
+			entries.splice(entries.begin(), entries, entry);
+			return &entries.front();
+		}
+	}
+	return nullptr;
+}
+
+RefractionCache::Entry& RefractionCache::Claim(uint64_t lensHash, double eta, const Light& light, double slabThickness) {
+	if (entries.size() >= capacity && !entries.empty()) {	//reuse the oldest entry's buffers rather than freeing and allocating them again
+		entries.splice(entries.begin(), entries, std::prev(entries.end()));
+	}
+	else { entries.emplace_front(); }
+	Entry& entry = entries.front();
+	entry.lensHash = lensHash;
+	entry.eta = eta;
+	entry.light = light;
+	entry.slabThickness = slabThickness;
+	entry.activeNear = 0;	//whatever it held was for other rays
+	entry.activeFar = -1;
+	return entry;
+}
+
+const AffineIntersections& RefractionCache::Get(uint64_t lensHash, double eta, const Light& light, double slabThickness, double receiverPlane, const RayBuffer& vertices, const RayBuffer& normals) {
+	if (Entry* hit = Find(lensHash, eta, light, slabThickness)) { return Active(hit, receiverPlane); }
+	Entry& entry = Claim(lensHash, eta, light, slabThickness);
+	if (slabThickness >= 0) { TraceSlab(vertices, normals, &entry.affine, eta, light, slabThickness); }
+	else {
+		Refract(vertices, normals, &refracteds, eta, light);
+		PrepareAffineIntersections(vertices, refracteds, &entry.affine);
+	}
+	return Active(&entry, receiverPlane);
+}
+
+const AffineIntersections& RefractionCache::Get(uint64_t lensHash, double eta, const Light& light, double receiverPlane, const QuantizedLens& lens) {
+	if (Entry* hit = Find(lensHash, eta, light, -1)) { return Active(hit, receiverPlane); }
+	Entry& entry = Claim(lensHash, eta, light, -1);
+	PrepareQuantizedIntersections(lens, eta, light, &entry.affine);
+	return Active(&entry, receiverPlane);
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <list>
+#include "raybuffer.h"
+#include "refract.h"
+
+class RefractionCache {	//the affine intersections for the last few refractive indices, so flipping back to a material we've already looked at skips the refraction pass
+public:
+	explicit RefractionCache(size_t capacity = 4) : capacity(capacity) {}
+
+	const AffineIntersections& Get(uint64_t lensHash, double eta, const Light& light, double slabThickness, double receiverPlane, const RayBuffer& vertices, const RayBuffer& normals);	//slabThickness is negative for the single surface model, refracts on a miss and evicts the least recently used entry
+	//only the rays that can land on screen near receiverPlane come back, the reference stays valid until the next call
+	const AffineIntersections& Get(uint64_t lensHash, double eta, const Light& light, double receiverPlane, const QuantizedLens& lens);	//the same for a quantized lens, which only has the single surface model
+	uint64_t Version() const { return version; }	//goes up whenever Get hands out rays it hasn't handed out before, for anything kept alongside them
+
+private:
+	struct Entry {
+		uint64_t lensHash;
+		double eta;
+		Light light;
+		double slabThickness;
+		AffineIntersections affine;
+		AffineIntersections active;		//compacted from affine for distances in [activeNear, activeFar]
+		double activeNear = 0, activeFar = -1;	//empty to begin with
+	};
+
+	const AffineIntersections& Active(Entry* entry, double receiverPlane);	//recompacts when the plane has moved out of the entry's window
+	Entry* Find(uint64_t lensHash, double eta, const Light& light, double slabThickness);	//moves a hit to the front
+	Entry& Claim(uint64_t lensHash, double eta, const Light& light, double slabThickness);	//the entry to refract a miss into, at the front
+
+	size_t capacity;
+	uint64_t version = 0;
+	std::list<Entry> entries;	//most recently used first, there are only ever a handful so a linear search is fine
+	RayBuffer refracteds;		//scratch, only needed between refracting and building the affine form
+};
@@ -0,0 +1,96 @@
+#include "reorder.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "threadpool.h"
+
+const uint32_t hilbertSide = uint32_t(1) << 16;	//the lens's bounding box gets quantized to a 65536x65536 grid, so the curve index takes 32 bits
+
+static uint32_t HilbertIndex(uint32_t x, uint32_t y) {	//distance along the curve of a grid cell, the usual quadrant at a time walk that rotates and flips the rest into place
+	uint32_t d = 0;
+	for (uint32_t s = hilbertSide / 2; s > 0; s /= 2) {
+		uint32_t rx = (x & s) > 0, ry = (y & s) > 0;
+		d += s * s * ((3 * rx) ^ ry);
+		if (ry == 0) {
+			if (rx == 1) {
+				x = hilbertSide - 1 - x;
+				y = hilbertSide - 1 - y;
+			}
+			std::swap(x, y);
+		}
+	}
+	return d;
+}
+
+static uint32_t GridCell(double position) { return position > 0 ? uint32_t(std::min(position, double(hilbertSide - 1))) : 0; }	//written so rounding past the far edge and NaNs both stay on the grid
+
+static void SortByHighWord(std::vector<uint64_t>* items) {	//the key is in the top 32 bits and the index in the bottom, least significant digit radix sort so it's linear and stable
+	std::vector<uint64_t> scratch(items->size());
+	for (int shift = 32; shift < 64; shift += 8) {	//an even number of passes, so the result ends up back in items
+		size_t starts[257] = {};
+		for (uint64_t item : *items) { starts[((item >> shift) & 0xff) + 1]++; }
+		for (int digit = 0; digit < 256; digit++) { starts[digit + 1] += starts[digit]; }
+		for (uint64_t item : *items) { scratch[starts[(item >> shift) & 0xff]++] = item; }
+		items->swap(scratch);
+	}
+}
+
+bool ReorderAlongHilbertCurve(std::vector<Eigen::Vector3d>* vertices, std::vector<Eigen::Vector3d>* normals, std::vector<Triangle>* triangles) {
+	size_t numVertices = vertices->size();
+	if (normals->size() != numVertices || numVertices >= UINT32_MAX) { return false; }
+	if (numVertices == 0) { return true; }
+
+	Eigen::Vector2d lowest = (*vertices)[0].head<2>(), highest = lowest;
+	for (const Eigen::Vector3d& vertex : *vertices) {
+		lowest = lowest.cwiseMin(vertex.head<2>());
+		highest = highest.cwiseMax(vertex.head<2>());
+	}
+	Eigen::Vector2d scale = Eigen::Vector2d::Constant(double(hilbertSide - 1)).cwiseQuotient((highest - lowest).cwiseMax(1e-300));	//a lens that's a line or a point still gets a valid, if useless, order
+
+	ThreadPool& pool = GlobalThreadPool();
+	const size_t itemsPerTask = size_t(1) << 16;
+	std::vector<uint64_t> keyed(numVertices);
+	pool.ParallelForRange(numVertices, itemsPerTask, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			Eigen::Vector2d cell = ((*vertices)[i].head<2>() - lowest).cwiseProduct(scale);
+			keyed[i] = (uint64_t(HilbertIndex(GridCell(cell.x()), GridCell(cell.y()))) << 32) | i;
+		}
+	});
+	SortByHighWord(&keyed);
+
+	std::vector<Eigen::Vector3d> sortedVertices(numVertices), sortedNormals(numVertices);
+	std::vector<uint32_t> newIndex(numVertices);
+	pool.ParallelForRange(numVertices, itemsPerTask, [&](size_t begin, size_t end) {
+		for (size_t j = begin; j < end; j++) {
+			uint32_t old = uint32_t(keyed[j]);
+			sortedVertices[j] = (*vertices)[old];
+			sortedNormals[j] = (*normals)[old];
+			newIndex[old] = uint32_t(j);
+		}
+	});
+	vertices->swap(sortedVertices);
+	normals->swap(sortedNormals);
+
+	size_t numTriangles = triangles->size();
+	bool sortTriangles = numTriangles < UINT32_MAX;	//the index has to fit in the low word
+	keyed.resize(sortTriangles ? numTriangles : 0);
+	pool.ParallelForRange(numTriangles, itemsPerTask, [&](size_t begin, size_t end) {
+		for (size_t t = begin; t < end; t++) {
+			Triangle& triangle = (*triangles)[t];
+			for (int c = 0; c < 3; c++) {	//the normals moved with the vertices, so they take the same new indices
+				triangle.vertices[c] = newIndex[triangle.vertices[c]];
+				triangle.normals[c] = newIndex[triangle.normals[c]];
+			}
+			if (sortTriangles) { keyed[t] = (uint64_t(triangle.vertices[0]) << 32) | t; }
+		}
+	});
+	if (!sortTriangles) { return true; }
+	SortByHighWord(&keyed);	//faces in the same order as their corners, so supersampling walks the vertices front to back too
+	std::vector<Triangle> sortedTriangles(numTriangles);
+	pool.ParallelForRange(numTriangles, itemsPerTask, [&](size_t begin, size_t end) {
+		for (size_t t = begin; t < end; t++) { sortedTriangles[t] = (*triangles)[uint32_t(keyed[t])]; }
+	});
+	triangles->swap(sortedTriangles);
+	return true;
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include <vector>
+#include "Eigen/Core"
+#include "lenscache.h"
+
+//puts the lens in an order where rays next to each other in memory start next to each other on the lens, so they tend to land near each other too
+//that keeps the kernels' loads and the splats' writes coherent without anything having to happen per frame
+
+bool ReorderAlongHilbertCurve(std::vector<Eigen::Vector3d>* vertices, std::vector<Eigen::Vector3d>* normals, std::vector<Triangle>* triangles);	//sorts vertices and normals together by their (x, y) position along a Hilbert curve, remaps the triangles and sorts them by their first corner
+//false and nothing changed if there isn't exactly one normal per vertex, since then the rays aren't vertex i with normal i
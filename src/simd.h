@@ -0,0 +1,149 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+//thin wrappers over the vector registers so the ray kernels can be written once and compiled to whatever the target supports
+//Batch<Scalar> is the widest batch of floats or doubles the build targets (-mavx512f, -mavx2 -mfma or /arch:AVX2), ScalarBatch<Scalar> is one lane and is used for the tails
+
+template<typename Scalar>
+struct ScalarBatch {
+	using Element = Scalar;
+	static constexpr size_t width = 1;
+	using Mask = bool;
+	Scalar v;
+
+	static ScalarBatch Load(const Scalar* p) { return { *p }; }
+	static ScalarBatch LoadWidened(const uint16_t* p) { return { Scalar(*p) }; }	//width 16 bit integers, converted exactly
+	static ScalarBatch Broadcast(Scalar s) { return { s }; }
+	void Store(Scalar* p) const { *p = v; }
+};
+
+template<typename Scalar> inline ScalarBatch<Scalar> operator+(ScalarBatch<Scalar> a, ScalarBatch<Scalar> b) { return { a.v + b.v }; }
+template<typename Scalar> inline ScalarBatch<Scalar> operator-(ScalarBatch<Scalar> a, ScalarBatch<Scalar> b) { return { a.v - b.v }; }
+template<typename Scalar> inline ScalarBatch<Scalar> operator*(ScalarBatch<Scalar> a, ScalarBatch<Scalar> b) { return { a.v * b.v }; }
+template<typename Scalar> inline ScalarBatch<Scalar> operator/(ScalarBatch<Scalar> a, ScalarBatch<Scalar> b) { return { a.v / b.v }; }
+template<typename Scalar> inline bool operator<=(ScalarBatch<Scalar> a, ScalarBatch<Scalar> b) { return a.v <= b.v; }
+template<typename Scalar> inline ScalarBatch<Scalar> Sqrt(ScalarBatch<Scalar> a) { return { std::sqrt(a.v) }; }
+template<typename Scalar> inline ScalarBatch<Scalar> Max(ScalarBatch<Scalar> a, ScalarBatch<Scalar> b) { return { std::max(a.v, b.v) }; }
+template<typename Scalar> inline ScalarBatch<Scalar> FusedMultiplyAdd(ScalarBatch<Scalar> a, ScalarBatch<Scalar> b, ScalarBatch<Scalar> c) { return { a.v * b.v + c.v }; }	//a*b + c
+template<typename Scalar> inline ScalarBatch<Scalar> Select(bool mask, ScalarBatch<Scalar> a, ScalarBatch<Scalar> b) { return mask ? a : b; }	//a where mask is set, b elsewhere
+inline size_t CountSet(bool mask) { return mask ? 1 : 0; }	//lanes set in a mask
+
+#if defined(__AVX512F__)
+
+struct BatchAVX512d {
+	using Element = double;
+	static constexpr size_t width = 8;
+	using Mask = __mmask8;
+	__m512d v;
+
+	static BatchAVX512d Load(const double* p) { return { _mm512_loadu_pd(p) }; }
+	static BatchAVX512d LoadWidened(const uint16_t* p) { return { _mm512_cvtepi32_pd(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)))) }; }
+	static BatchAVX512d Broadcast(double s) { return { _mm512_set1_pd(s) }; }
+	void Store(double* p) const { _mm512_storeu_pd(p, v); }
+};
+
+inline BatchAVX512d operator+(BatchAVX512d a, BatchAVX512d b) { return { _mm512_add_pd(a.v, b.v) }; }
+inline BatchAVX512d operator-(BatchAVX512d a, BatchAVX512d b) { return { _mm512_sub_pd(a.v, b.v) }; }
+inline BatchAVX512d operator*(BatchAVX512d a, BatchAVX512d b) { return { _mm512_mul_pd(a.v, b.v) }; }
+inline BatchAVX512d operator/(BatchAVX512d a, BatchAVX512d b) { return { _mm512_div_pd(a.v, b.v) }; }
+inline __mmask8 operator<=(BatchAVX512d a, BatchAVX512d b) { return _mm512_cmp_pd_mask(a.v, b.v, _CMP_LE_OQ); }
+inline BatchAVX512d Sqrt(BatchAVX512d a) { return { _mm512_sqrt_pd(a.v) }; }
+inline BatchAVX512d Max(BatchAVX512d a, BatchAVX512d b) { return { _mm512_max_pd(a.v, b.v) }; }
+inline BatchAVX512d FusedMultiplyAdd(BatchAVX512d a, BatchAVX512d b, BatchAVX512d c) { return { _mm512_fmadd_pd(a.v, b.v, c.v) }; }
+inline BatchAVX512d Select(__mmask8 mask, BatchAVX512d a, BatchAVX512d b) { return { _mm512_mask_blend_pd(mask, b.v, a.v) }; }
+inline size_t CountSet(__mmask8 mask) { return size_t(std::popcount(unsigned(mask))); }
+
+struct BatchAVX512f {
+	using Element = float;
+	static constexpr size_t width = 16;
+	using Mask = __mmask16;
+	__m512 v;
+
+	static BatchAVX512f Load(const float* p) { return { _mm512_loadu_ps(p) }; }
+	static BatchAVX512f LoadWidened(const uint16_t* p) { return { _mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)))) }; }
+	static BatchAVX512f Broadcast(float s) { return { _mm512_set1_ps(s) }; }
+	void Store(float* p) const { _mm512_storeu_ps(p, v); }
+};
+
+inline BatchAVX512f operator+(BatchAVX512f a, BatchAVX512f b) { return { _mm512_add_ps(a.v, b.v) }; }
+inline BatchAVX512f operator-(BatchAVX512f a, BatchAVX512f b) { return { _mm512_sub_ps(a.v, b.v) }; }
+inline BatchAVX512f operator*(BatchAVX512f a, BatchAVX512f b) { return { _mm512_mul_ps(a.v, b.v) }; }
+inline BatchAVX512f operator/(BatchAVX512f a, BatchAVX512f b) { return { _mm512_div_ps(a.v, b.v) }; }
+inline __mmask16 operator<=(BatchAVX512f a, BatchAVX512f b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ); }
+inline BatchAVX512f Sqrt(BatchAVX512f a) { return { _mm512_sqrt_ps(a.v) }; }
+inline BatchAVX512f Max(BatchAVX512f a, BatchAVX512f b) { return { _mm512_max_ps(a.v, b.v) }; }
+inline BatchAVX512f FusedMultiplyAdd(BatchAVX512f a, BatchAVX512f b, BatchAVX512f c) { return { _mm512_fmadd_ps(a.v, b.v, c.v) }; }
+inline BatchAVX512f Select(__mmask16 mask, BatchAVX512f a, BatchAVX512f b) { return { _mm512_mask_blend_ps(mask, b.v, a.v) }; }
+inline size_t CountSet(__mmask16 mask) { return size_t(std::popcount(unsigned(mask))); }
+
+template<typename Scalar> struct NativeBatch { using Type = ScalarBatch<Scalar>; };
+template<> struct NativeBatch<double> { using Type = BatchAVX512d; };
+template<> struct NativeBatch<float> { using Type = BatchAVX512f; };
+
+#elif defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))	//msvc's /arch:AVX2 implies fma but doesn't define __FMA__
+
+struct BatchAVX2d {
+	using Element = double;
+	static constexpr size_t width = 4;
+	using Mask = __m256d;
+	__m256d v;
+
+	static BatchAVX2d Load(const double* p) { return { _mm256_loadu_pd(p) }; }
+	static BatchAVX2d LoadWidened(const uint16_t* p) { return { _mm256_cvtepi32_pd(_mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)))) }; }
+	static BatchAVX2d Broadcast(double s) { return { _mm256_set1_pd(s) }; }
+	void Store(double* p) const { _mm256_storeu_pd(p, v); }
+};
+
+inline BatchAVX2d operator+(BatchAVX2d a, BatchAVX2d b) { return { _mm256_add_pd(a.v, b.v) }; }
+inline BatchAVX2d operator-(BatchAVX2d a, BatchAVX2d b) { return { _mm256_sub_pd(a.v, b.v) }; }
+inline BatchAVX2d operator*(BatchAVX2d a, BatchAVX2d b) { return { _mm256_mul_pd(a.v, b.v) }; }
+inline BatchAVX2d operator/(BatchAVX2d a, BatchAVX2d b) { return { _mm256_div_pd(a.v, b.v) }; }
+inline __m256d operator<=(BatchAVX2d a, BatchAVX2d b) { return _mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ); }
+inline BatchAVX2d Sqrt(BatchAVX2d a) { return { _mm256_sqrt_pd(a.v) }; }
+inline BatchAVX2d Max(BatchAVX2d a, BatchAVX2d b) { return { _mm256_max_pd(a.v, b.v) }; }
+inline BatchAVX2d FusedMultiplyAdd(BatchAVX2d a, BatchAVX2d b, BatchAVX2d c) { return { _mm256_fmadd_pd(a.v, b.v, c.v) }; }
+inline BatchAVX2d Select(__m256d mask, BatchAVX2d a, BatchAVX2d b) { return { _mm256_blendv_pd(b.v, a.v, mask) }; }
+inline size_t CountSet(__m256d mask) { return size_t(std::popcount(unsigned(_mm256_movemask_pd(mask)))); }
+
+struct BatchAVX2f {
+	using Element = float;
+	static constexpr size_t width = 8;
+	using Mask = __m256;
+	__m256 v;
+
+	static BatchAVX2f Load(const float* p) { return { _mm256_loadu_ps(p) }; }
+	static BatchAVX2f LoadWidened(const uint16_t* p) { return { _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)))) }; }
+	static BatchAVX2f Broadcast(float s) { return { _mm256_set1_ps(s) }; }
+	void Store(float* p) const { _mm256_storeu_ps(p, v); }
+};
+
+inline BatchAVX2f operator+(BatchAVX2f a, BatchAVX2f b) { return { _mm256_add_ps(a.v, b.v) }; }
+inline BatchAVX2f operator-(BatchAVX2f a, BatchAVX2f b) { return { _mm256_sub_ps(a.v, b.v) }; }
+inline BatchAVX2f operator*(BatchAVX2f a, BatchAVX2f b) { return { _mm256_mul_ps(a.v, b.v) }; }
+inline BatchAVX2f operator/(BatchAVX2f a, BatchAVX2f b) { return { _mm256_div_ps(a.v, b.v) }; }
+inline __m256 operator<=(BatchAVX2f a, BatchAVX2f b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+inline BatchAVX2f Sqrt(BatchAVX2f a) { return { _mm256_sqrt_ps(a.v) }; }
+inline BatchAVX2f Max(BatchAVX2f a, BatchAVX2f b) { return { _mm256_max_ps(a.v, b.v) }; }
+inline BatchAVX2f FusedMultiplyAdd(BatchAVX2f a, BatchAVX2f b, BatchAVX2f c) { return { _mm256_fmadd_ps(a.v, b.v, c.v) }; }
+inline BatchAVX2f Select(__m256 mask, BatchAVX2f a, BatchAVX2f b) { return { _mm256_blendv_ps(b.v, a.v, mask) }; }
+inline size_t CountSet(__m256 mask) { return size_t(std::popcount(unsigned(_mm256_movemask_ps(mask)))); }
+
+template<typename Scalar> struct NativeBatch { using Type = ScalarBatch<Scalar>; };
+template<> struct NativeBatch<double> { using Type = BatchAVX2d; };
+template<> struct NativeBatch<float> { using Type = BatchAVX2f; };
+
+#else
+
+template<typename Scalar> struct NativeBatch { using Type = ScalarBatch<Scalar>; };	//no vector extensions enabled, the kernels still work a lane at a time
+
+#endif
+
+template<typename Scalar> using Batch = typename NativeBatch<Scalar>::Type;
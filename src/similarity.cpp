@@ -0,0 +1,163 @@
+#include "similarity.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "simd.h"
+
+using FloatBatch = Batch<float>;
+
+static float HorizontalSum(FloatBatch b) {
+	float lanes[FloatBatch::width];
+	b.Store(lanes);
+	float sum = 0;
+	for (float lane : lanes) { sum += lane; }
+	return sum;
+}
+
+static void Scale(const float* in, float scale, size_t n, float* out) {
+	for (size_t i = 0; i < n; i++) { out[i] = in[i] * scale; }
+}
+
+static double MeanOf(const std::vector<float>& pixels) {
+	double sum = 0;
+	for (float value : pixels) { sum += value; }
+	return pixels.empty() ? 0 : sum / double(pixels.size());
+}
+
+static double RootMeanSquareDifference(const std::vector<float>& a, const std::vector<float>& b, int width, int height) {
+	double total = 0;
+	for (int y = 0; y < height; y++) {	//float lanes within a row, double across rows
+		const float* rowA = a.data() + size_t(y) * width;
+		const float* rowB = b.data() + size_t(y) * width;
+		FloatBatch sum = FloatBatch::Broadcast(0);
+		size_t x = 0;
+		for (; x + FloatBatch::width <= size_t(width); x += FloatBatch::width) {
+			FloatBatch difference = FloatBatch::Load(rowA + x) - FloatBatch::Load(rowB + x);
+			sum = FusedMultiplyAdd(difference, difference, sum);
+		}
+		float rowSum = HorizontalSum(sum);
+		for (; x < size_t(width); x++) { rowSum += (rowA[x] - rowB[x]) * (rowA[x] - rowB[x]); }
+		total += rowSum;
+	}
+	return std::sqrt(total / (double(width) * height));
+}
+
+static void BoxFilter(const std::vector<float>& in, int width, int height, int radius, std::vector<float>* rowSums, std::vector<float>* out) {	//sums over the (2*radius+1)^2 window around each pixel, clipped at the edges
+	rowSums->resize(in.size());
+	out->assign(in.size(), 0.0f);
+	for (int y = 0; y < height; y++) {	//along each row first, added up directly rather than as a running sum so there's no rounding drift across the row
+		const float* row = in.data() + size_t(y) * width;
+		float* sums = rowSums->data() + size_t(y) * width;
+		for (int x = 0; x < width; x++) {
+			float sum = 0;
+			for (int window = std::max(0, x - radius); window <= std::min(width - 1, x + radius); window++) { sum += row[window]; }
+			sums[x] = sum;
+		}
+	}
+	for (int y = 0; y < height; y++) {	//then add up whole rows, which is contiguous and vectorizes
+		float* outRow = out->data() + size_t(y) * width;
+		for (int window = std::max(0, y - radius); window <= std::min(height - 1, y + radius); window++) {
+			const float* sums = rowSums->data() + size_t(window) * width;
+			for (int x = 0; x < width; x++) { outRow[x] += sums[x]; }
+		}
+	}
+}
+
+template<typename B>
+static B WindowSimilarity(const float* inverseCount, const float* sumA, const float* sumB, const float* sumAA, const float* sumBB, const float* sumAB) {	//ssim of one batch of windows from their sums
+	const B two = B::Broadcast(2), c1 = B::Broadcast(0.01f * 0.01f), c2 = B::Broadcast(0.03f * 0.03f);	//the usual constants for images in the 0 to 1 range
+	B n = B::Load(inverseCount);
+	B meanA = B::Load(sumA) * n, meanB = B::Load(sumB) * n;
+	B varianceA = B::Load(sumAA) * n - meanA * meanA;
+	B varianceB = B::Load(sumBB) * n - meanB * meanB;
+	B covariance = B::Load(sumAB) * n - meanA * meanB;
+	return ((two * meanA * meanB + c1) * (two * covariance + c2)) / ((meanA * meanA + meanB * meanB + c1) * (varianceA + varianceB + c2));
+}
+
+static double StructuralSimilarity(const std::vector<float>& a, const std::vector<float>& b, int width, int height) {
+	const int radius = 3;
+	size_t numPixels = a.size();
+	std::vector<float> aa(numPixels), bb(numPixels), ab(numPixels);
+	for (size_t i = 0; i < numPixels; i++) {
+		aa[i] = a[i] * a[i];
+		bb[i] = b[i] * b[i];
+		ab[i] = a[i] * b[i];
+	}
+	std::vector<float> scratch, sumA, sumB, sumAA, sumBB, sumAB;
+	BoxFilter(a, width, height, radius, &scratch, &sumA);
+	BoxFilter(b, width, height, radius, &scratch, &sumB);
+	BoxFilter(aa, width, height, radius, &scratch, &sumAA);
+	BoxFilter(bb, width, height, radius, &scratch, &sumBB);
+	BoxFilter(ab, width, height, radius, &scratch, &sumAB);
+
+	std::vector<float> inverseCount(width);	//one over the number of pixels in each window of the current row
+	double total = 0;
+	for (int y = 0; y < height; y++) {
+		int rows = std::min(height - 1, y + radius) - std::max(0, y - radius) + 1;
+		for (int x = 0; x < width; x++) { inverseCount[x] = 1.0f / float(rows * (std::min(width - 1, x + radius) - std::max(0, x - radius) + 1)); }
+
+		size_t row = size_t(y) * width;
+		FloatBatch sum = FloatBatch::Broadcast(0);
+		size_t x = 0;
+		for (; x + FloatBatch::width <= size_t(width); x += FloatBatch::width) {
+			sum = sum + WindowSimilarity<FloatBatch>(&inverseCount[x], &sumA[row + x], &sumB[row + x], &sumAA[row + x], &sumBB[row + x], &sumAB[row + x]);
+		}
+		float rowSum = HorizontalSum(sum);
+		for (; x < size_t(width); x++) { rowSum += WindowSimilarity<ScalarBatch<float>>(&inverseCount[x], &sumA[row + x], &sumB[row + x], &sumAA[row + x], &sumBB[row + x], &sumAB[row + x]).v; }
+		total += rowSum;
+	}
+	return total / double(numPixels);
+}
+
+static double EarthMoversDistance(const std::vector<float>& a, const std::vector<float>& b, int width, int height) {	//sliced: along a line the distance is exact and is just the area between the two cumulative distributions
+	const int directions[4][2] = { { 1, 0 }, { 0, 1 }, { 1, 1 }, { 1, -1 } };
+	double sumA = 0, sumB = 0;
+	for (size_t i = 0; i < a.size(); i++) {
+		sumA += a[i];
+		sumB += b[i];
+	}
+	if (sumA <= 0 || sumB <= 0) { return 0; }
+
+	double total = 0;
+	std::vector<double> projected;	//difference of the two images at unit total mass, projected onto the direction
+	for (const int* direction : directions) {
+		int dx = direction[0], dy = direction[1];
+		int numBins = (width - 1) * std::abs(dx) + (height - 1) * std::abs(dy) + 1;
+		int binOffset = dy < 0 ? height - 1 : 0;
+		projected.assign(size_t(numBins), 0.0);
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				size_t i = size_t(y) * width + x;
+				projected[size_t(x * dx + y * dy + binOffset)] += a[i] / sumA - b[i] / sumB;
+			}
+		}
+		double cumulative = 0, distance = 0;
+		for (double mass : projected) {
+			cumulative += mass;
+			distance += std::abs(cumulative);
+		}
+		total += distance / std::sqrt(double(dx * dx + dy * dy));	//bins along a diagonal are closer together than a pixel
+	}
+	return total / 4 * 1.5707963267948966;	//the mean of |cos| over directions is 2/pi, this way a shifted image scores about the length of the shift
+}
+
+bool CompareToTarget(const Irradiance& irradiance, const Image& target, SimilarityScore* score) {
+	if (irradiance.width != target.width || irradiance.height != target.height || target.pixels.empty()) { return false; }
+	double meanIrradiance = MeanOf(irradiance.pixels), meanTarget = MeanOf(target.pixels);
+	size_t numPixels = target.pixels.size();
+	std::vector<float> a(numPixels), b(numPixels);	//both at unit mean, an all black image stays black
+	Scale(irradiance.pixels.data(), meanIrradiance > 0 ? float(1 / meanIrradiance) : 0.0f, numPixels, a.data());
+	Scale(target.pixels.data(), meanTarget > 0 ? float(1 / meanTarget) : 0.0f, numPixels, b.data());
+
+	score->l2 = RootMeanSquareDifference(a, b, target.width, target.height);
+	score->emd = EarthMoversDistance(a, b, target.width, target.height);
+
+	float targetMax = *std::max_element(b.begin(), b.end());	//ssim's constants assume the brightest pixel is 1
+	if (targetMax > 0) {
+		Scale(a.data(), 1 / targetMax, numPixels, a.data());
+		Scale(b.data(), 1 / targetMax, numPixels, b.data());
+	}
+	score->ssim = StructuralSimilarity(a, b, target.width, target.height);
+	return true;
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include "image.h"
+#include "irradiance.h"
+
+struct SimilarityScore {	//how close a computed caustic is to the target, both images are scaled to the same mean first since the ray count sets the brightness
+	double l2 = 0;		//root mean square difference, 0 for a perfect match
+	double ssim = 0;	//mean structural similarity over 7x7 windows, 1 for a perfect match
+	double emd = 0;		//earth mover's distance in pixels, sliced along four directions where it can be computed exactly, a shifted image scores about the length of the shift, 0 for a perfect match
+};
+
+bool CompareToTarget(const Irradiance& irradiance, const Image& target, SimilarityScore* score);	//false if the irradiance isn't at the target's resolution
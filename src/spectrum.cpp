@@ -0,0 +1,47 @@
+#include "spectrum.h"
+
+#include <cmath>
+
+double RefractiveIndex(const CauchyGlass& glass, double wavelength) {
+	return glass.a + glass.b / (wavelength * wavelength);
+}
+
+double RefractiveIndex(const SellmeierGlass& glass, double wavelength) {
+	double wavelength2 = wavelength * wavelength;
+	double n2 = 1;
+	for (int i = 0; i < 3; i++) { n2 += glass.b[i] * wavelength2 / (wavelength2 - glass.c[i]); }
+	return std::sqrt(n2);
+}
+
+static float Response(double wavelength, double peak, double width) {	//rough bell shaped stand in for a colour matching function
+	double x = (wavelength - peak) / width;
+	return float(std::exp(-0.5 * x * x));
+}
+
+std::vector<SpectralBand> MakeSpectralBands(int numBands, double eta, const std::string& model) {
+	std::vector<SpectralBand> bands;
+	CauchyGlass cauchy = { eta - fusedSilicaCauchyB / (designWavelength * designWavelength), fusedSilicaCauchyB };
+	double sellmeierShift = eta - RefractiveIndex(fusedSilica, designWavelength);	//keeps the dispersion of fused silica but moves it to the lens's index
+	for (int i = 0; i < numBands; i++) {
+		SpectralBand band;
+		band.wavelength = numBands == 1 ? designWavelength : 0.42 + 0.26 * i / (numBands - 1);
+		band.eta = model == "sellmeier" ? RefractiveIndex(fusedSilica, band.wavelength) + sellmeierShift : RefractiveIndex(cauchy, band.wavelength);
+		band.weights.red = Response(band.wavelength, 0.61, 0.05);
+		band.weights.green = Response(band.wavelength, 0.55, 0.045);
+		band.weights.blue = Response(band.wavelength, 0.46, 0.04);
+		bands.push_back(band);
+	}
+
+	float red = 0, green = 0, blue = 0;
+	for (const SpectralBand& band : bands) {
+		red += band.weights.red;
+		green += band.weights.green;
+		blue += band.weights.blue;
+	}
+	for (SpectralBand& band : bands) {
+		band.weights.red /= red;
+		band.weights.green /= green;
+		band.weights.blue /= blue;
+	}
+	return bands;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "irradiance.h"
+
+//wavelengths are in micrometres throughout, which is what the published glass coefficients use
+
+struct CauchyGlass {	//n = a + b/wavelength^2, fine across the visible range for most optical glasses
+	double a;
+	double b;
+};
+
+struct SellmeierGlass {	//n^2 = 1 + sum of b*wavelength^2/(wavelength^2 - c)
+	double b[3];
+	double c[3];
+};
+
+const SellmeierGlass fusedSilica = { { 0.6961663, 0.4079426, 0.8974794 }, { 0.0684043 * 0.0684043, 0.1162414 * 0.1162414, 9.896161 * 9.896161 } };	//Malitson 1965
+const double fusedSilicaCauchyB = 0.00354;
+const double designWavelength = 0.5876;	//the helium d line, the lens's single eta is taken to be its index here
+
+double RefractiveIndex(const CauchyGlass& glass, double wavelength);
+double RefractiveIndex(const SellmeierGlass& glass, double wavelength);
+
+struct SpectralBand {	//one wavelength of the light source and how it shows up on screen
+	double wavelength;
+	double eta;
+	ChannelWeights weights;	//each channel's weights sum to 1 over all the bands, so a caustic without any dispersion comes out white
+};
+
+std::vector<SpectralBand> MakeSpectralBands(int numBands, double eta, const std::string& model);	//spread over 420-680nm, model is "cauchy" or "sellmeier", either one shifted so the index at the design wavelength is eta
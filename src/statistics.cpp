@@ -0,0 +1,73 @@
+#include "statistics.h"
+
+#include <fstream>
+
+static thread_local int stageDepth[numStages] = {};	//how many timers of each stage are open on this thread
+
+const char* StageName(Stage stage) {
+	switch (stage) {
+	case Stage::Parse: return "parse";
+	case Stage::Refract: return "refract";
+	case Stage::Intersect: return "intersect";
+	case Stage::Accumulate: return "accumulate";
+	case Stage::ToneMap: return "tone_map";
+	case Stage::Draw: return "draw";
+	case Stage::Reduce: return "reduce";
+	}
+	return "unknown";
+}
+
+Statistics& GlobalStatistics() {
+	static Statistics statistics;
+	return statistics;
+}
+
+ScopedTimer::ScopedTimer(Stage stage) : stage(stage), outermost(stageDepth[size_t(stage)]++ == 0) {
+	if (outermost) { start = std::chrono::steady_clock::now(); }
+}
+
+ScopedTimer::~ScopedTimer() {
+	stageDepth[size_t(stage)]--;
+	if (!outermost) { return; }
+	uint64_t nanoseconds = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+	Statistics& statistics = GlobalStatistics();
+	statistics.stageNanoseconds[size_t(stage)].fetch_add(nanoseconds, std::memory_order_relaxed);
+	statistics.lastStageNanoseconds[size_t(stage)].store(nanoseconds, std::memory_order_relaxed);
+	statistics.stageCalls[size_t(stage)].fetch_add(1, std::memory_order_relaxed);
+}
+
+static double Percent(uint64_t part, uint64_t whole) { return whole > 0 ? 100.0 * double(part) / double(whole) : 0.0; }
+
+void PrintStatistics(std::ostream& out) {
+	const Statistics& statistics = GlobalStatistics();
+	for (size_t i = 0; i < numStages; i++) {
+		uint64_t calls = statistics.stageCalls[i].load(std::memory_order_relaxed);
+		if (calls == 0) { continue; }
+		double total = double(statistics.stageNanoseconds[i].load(std::memory_order_relaxed)) / 1e6;
+		double last = double(statistics.lastStageNanoseconds[i].load(std::memory_order_relaxed)) / 1e6;
+		out << "  " << StageName(Stage(i)) << ": " << last << " ms last, " << total / double(calls) << " ms average over " << calls << " calls\n";
+	}
+	uint64_t refracted = statistics.raysRefracted.load(std::memory_order_relaxed), reflected = statistics.totalInternalReflections.load(std::memory_order_relaxed);
+	uint64_t splatted = statistics.raysSplatted.load(std::memory_order_relaxed), offScreen = statistics.raysOffScreen.load(std::memory_order_relaxed);
+	out << "  rays: " << refracted << " refracted, " << reflected << " TIR (" << Percent(reflected, refracted) << "%), "
+		<< splatted << " splatted, " << offScreen << " off screen (" << Percent(offScreen, splatted) << "%)\n";
+}
+
+bool WriteStatistics(const std::string& path) {
+	const Statistics& statistics = GlobalStatistics();
+	std::ofstream file(path, std::ios::trunc);
+	if (!file.is_open()) { return false; }
+	file << "{\n\t\"stages\": {\n";
+	for (size_t i = 0; i < numStages; i++) {
+		file << "\t\t\"" << StageName(Stage(i)) << "\": { \"calls\": " << statistics.stageCalls[i].load(std::memory_order_relaxed)
+			<< ", \"total_seconds\": " << double(statistics.stageNanoseconds[i].load(std::memory_order_relaxed)) / 1e9
+			<< ", \"last_seconds\": " << double(statistics.lastStageNanoseconds[i].load(std::memory_order_relaxed)) / 1e9 << " }" << (i + 1 < numStages ? "," : "") << "\n";
+	}
+	file << "\t},\n";
+	file << "\t\"rays_refracted\": " << statistics.raysRefracted.load(std::memory_order_relaxed) << ",\n";
+	file << "\t\"total_internal_reflections\": " << statistics.totalInternalReflections.load(std::memory_order_relaxed) << ",\n";
+	file << "\t\"rays_splatted\": " << statistics.raysSplatted.load(std::memory_order_relaxed) << ",\n";
+	file << "\t\"rays_off_screen\": " << statistics.raysOffScreen.load(std::memory_order_relaxed) << "\n";
+	file << "}\n";
+	return bool(file);
+}
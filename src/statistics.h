@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+//running totals of where the time goes and what happens to the rays, cheap enough to always be on
+//the timers cost two clock reads per call of a stage, the counters one relaxed atomic add per chunk of rays
+
+enum class Stage { Parse, Refract, Intersect, Accumulate, ToneMap, Draw, Reduce };	//Reduce is waiting on and summing other nodes' histograms in a distributed sweep
+const size_t numStages = 7;
+
+const char* StageName(Stage stage);
+
+struct Statistics {	//totals since the program started
+	std::atomic<uint64_t> stageNanoseconds[numStages] = {};
+	std::atomic<uint64_t> lastStageNanoseconds[numStages] = {};	//the latest call, so a slow frame shows up without being averaged away
+	std::atomic<uint64_t> stageCalls[numStages] = {};
+	std::atomic<uint64_t> raysRefracted{0};				//once per ray per refraction, so every wavelength counts for dispersion
+	std::atomic<uint64_t> totalInternalReflections{0};	//of those, the ones that took the TIR fallback
+	std::atomic<uint64_t> raysSplatted{0};				//once per ray per histogram
+	std::atomic<uint64_t> raysOffScreen{0};				//of those, the ones that missed the image, TIR rays are aimed off to the side so they show up here too
+};
+
+Statistics& GlobalStatistics();
+
+class ScopedTimer {	//adds the time until it goes out of scope to the stage, a stage that calls itself or another entry point of the same stage only counts once
+public:
+	explicit ScopedTimer(Stage stage);
+	~ScopedTimer();
+	ScopedTimer(const ScopedTimer&) = delete;
+	ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+	Stage stage;
+	bool outermost;
+	std::chrono::steady_clock::time_point start;
+};
+
+inline void CountRefracted(size_t rays, size_t reflected) {
+	Statistics& statistics = GlobalStatistics();
+	statistics.raysRefracted.fetch_add(rays, std::memory_order_relaxed);
+	statistics.totalInternalReflections.fetch_add(reflected, std::memory_order_relaxed);
+}
+
+inline void CountSplatted(size_t rays, size_t offScreen) {
+	Statistics& statistics = GlobalStatistics();
+	statistics.raysSplatted.fetch_add(rays, std::memory_order_relaxed);
+	statistics.raysOffScreen.fetch_add(offScreen, std::memory_order_relaxed);
+}
+
+void PrintStatistics(std::ostream& out);	//one line per stage and one for the rays, for the viewer's Q key
+bool WriteStatistics(const std::string& path);	//the same as json, for batch runs
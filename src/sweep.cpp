@@ -0,0 +1,229 @@
+#include "sweep.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "statistics.h"
+#include "threadpool.h"
+
+const size_t raysPerBlock = 4096;	//4 arrays of 4096 rays is at most 128KB, so a block stays in L2 while it gets splatted once per distance
+const size_t histogramBudget = size_t(1) << 29;	//bytes of private histograms we're willing to hold across all the tasks
+
+static size_t DistancesPerPass(size_t numDistances, size_t numPixels, size_t bytesPerCount) {	//how many distances one task's histograms can cover within the budget, sweeps with more take several passes over the rays
+	return std::clamp<size_t>(histogramBudget / (numPixels * bytesPerCount), 1, numDistances);	//a single image bigger than the whole budget still gets its one histogram, it's no bigger than the image itself
+}
+
+static size_t SweepTasks(size_t numDistances, size_t numPixels, size_t numBlocks, size_t bytesPerCount) {	//numDistances from DistancesPerPass, so at least one task always fits
+	size_t bytesPerTask = numDistances * numPixels * bytesPerCount;
+	return std::max<size_t>(1, std::min<size_t>({ size_t(GlobalThreadPool().NumThreads()), histogramBudget / bytesPerTask, numBlocks }));
+}
+
+template<typename Scalar, typename Count>
+static size_t SplatBlock(const BasicAffineIntersections<Scalar>& affine, size_t begin, size_t end, const Count* weights, std::span<const double> distances, int width, int height, Count* histograms) {	//weights are per ray starting at begin, or nullptr for one each, returns how many splats missed
+	//plain counts go into uint32_t's and weighted ones into doubles, a float histogram stops counting at 2^24 and the focused pixels of a big lens get there
+	size_t numPixels = size_t(width) * size_t(height), offScreen = 0;
+	Scalar scaleX = Scalar(width) / 256, scaleY = Scalar(height) / 256;
+	Scalar fWidth = Scalar(width), fHeight = Scalar(height);
+	for (size_t k = 0; k < distances.size(); k++) {	//the block's rays come out of cache for every distance after the first
+		Scalar d = Scalar(distances[k]);
+		Count* histogram = histograms + k * numPixels;
+		for (size_t i = begin; i < end; i++) {
+			Scalar x = (affine.offset.x[i] + d * affine.slope.x[i]) * scaleX;
+			Scalar y = (affine.offset.y[i] + d * affine.slope.y[i]) * scaleY;
+			if (!(x >= 0 && x < fWidth && y >= 0 && y < fHeight)) { offScreen++; continue; }
+			histogram[size_t(y) * size_t(width) + size_t(x)] += weights == nullptr ? Count(1) : weights[i - begin];
+		}
+	}
+	return offScreen;
+}
+
+template<typename Count>
+static void MergePartials(const std::vector<std::vector<Count>>& partials, std::span<Irradiance> images) {	//one distance per task, the counts only become floats here, where each partial already holds its whole share
+	GlobalThreadPool().ParallelFor(images.size(), [&](size_t k) {
+		float* total = images[k].pixels.data();
+		size_t numPixels = images[k].pixels.size();
+		for (const std::vector<Count>& histograms : partials) {
+			const Count* partial = histograms.data() + k * numPixels;
+			for (size_t i = 0; i < numPixels; i++) { total[i] += float(partial[i]); }
+		}
+	});
+}
+
+template<typename Count>
+static void ClearPartials(size_t numTasks, size_t size, std::vector<std::vector<Count>>* partials) {	//zeroed by the tasks that will fill them, so each one's pages start out near its thread
+	partials->resize(numTasks);
+	GlobalThreadPool().ParallelFor(numTasks, [&](size_t task) { (*partials)[task].assign(size, Count(0)); });
+}
+
+template<typename Scalar>
+static void SplatIntoPartials(const BasicAffineIntersections<Scalar>& affine, std::span<const double> distances, int width, int height, std::vector<std::vector<uint32_t>>* partials) {	//one task per partial, each adds its share of the rays on top of whatever its histograms already hold
+	size_t numRays = affine.size(), numTasks = partials->size();
+	GlobalThreadPool().ParallelFor(numTasks, [&](size_t task) {
+		uint32_t* histograms = (*partials)[task].data();	//task t's histogram for distance k starts at k*numPixels
+		size_t begin = numRays * task / numTasks, end = numRays * (task + 1) / numTasks;
+		size_t offScreen = 0;
+		for (size_t block = begin; block < end; block += raysPerBlock) { offScreen += SplatBlock<Scalar, uint32_t>(affine, block, std::min(end, block + raysPerBlock), nullptr, distances, width, height, histograms); }
+		CountSplatted((end - begin) * distances.size(), offScreen);
+	});
+}
+
+template<typename Scalar>
+void FocusSweep(const BasicAffineIntersections<Scalar>& affine, std::span<const double> distances, int width, int height, std::vector<Irradiance>* images) {
+	ScopedTimer timer(Stage::Accumulate);
+	size_t numDistances = distances.size();
+	size_t numPixels = size_t(width) * size_t(height);
+	size_t numRays = affine.size();
+
+	images->resize(numDistances);
+	for (Irradiance& image : *images) { image.Resize(width, height); }
+	if (numDistances == 0 || numPixels == 0 || numRays == 0) { return; }
+
+	size_t perPass = DistancesPerPass(numDistances, numPixels, sizeof(uint32_t));
+	std::vector<std::vector<uint32_t>> partials;
+	for (size_t first = 0; first < numDistances; first += perPass) {	//more distances than the budget holds go over the rays again for each set of them
+		std::span<const double> passDistances = distances.subspan(first, std::min(perPass, numDistances - first));
+		ClearPartials(SweepTasks(passDistances.size(), numPixels, (numRays + raysPerBlock - 1) / raysPerBlock, sizeof(uint32_t)), passDistances.size() * numPixels, &partials);
+		SplatIntoPartials(affine, passDistances, width, height, &partials);
+		MergePartials(partials, std::span<Irradiance>(images->data() + first, passDistances.size()));
+	}
+}
+
+template<typename Scalar>
+static double ProjectedArea(const BasicRayBuffer<Scalar>& vertices, const Triangle& triangle, const Light& light) {	//area seen across the direction the light arrives from, which is how much of it the triangle catches
+	uint32_t a = triangle.vertices[0], b = triangle.vertices[1], c = triangle.vertices[2];
+	Eigen::Vector3d pa(vertices.x[a], vertices.y[a], vertices.z[a]), pb(vertices.x[b], vertices.y[b], vertices.z[b]), pc(vertices.x[c], vertices.y[c], vertices.z[c]);
+	Eigen::Vector3d ab = pb - pa, ac = pc - pa;
+	Eigen::Vector3d normal(ab.y() * ac.z() - ab.z() * ac.y(), ab.z() * ac.x() - ab.x() * ac.z(), ab.x() * ac.y() - ab.y() * ac.x());	//ab x ac, twice the area along the face normal
+	if (light.type == Light::Type::Axial) { return std::abs(normal.z()) / 2; }
+	Eigen::Vector3d incident = light.type == Light::Type::Directional ? light.direction : Eigen::Vector3d((pa + pb + pc) / 3 - light.position);	//a point light reaches each triangle from its own direction
+	double length = incident.norm();
+	return length > 0 ? std::abs(normal.dot(incident)) / length / 2 : 0;
+}
+
+template<typename Scalar>
+void SupersampledSweep(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& normals, std::span<const Triangle> triangles, int samplesPerTriangle, double n, const Light& light, std::span<const double> distances, int width, int height, std::vector<Irradiance>* images, uint64_t seed) {
+	ScopedTimer timer(Stage::Accumulate);	//the rays are made inside the splatting tasks, so their refraction time lands here too
+	size_t numDistances = distances.size();
+	size_t numPixels = size_t(width) * size_t(height);
+	size_t numTriangles = triangles.size();
+	size_t perTriangle = size_t(std::max(samplesPerTriangle, 1));
+
+	images->resize(numDistances);
+	for (Irradiance& image : *images) { image.Resize(width, height); }
+	if (numDistances == 0 || numPixels == 0 || numTriangles == 0) { return; }
+
+	ThreadPool& pool = GlobalThreadPool();
+	const size_t trianglesPerAreaTask = size_t(1) << 16;
+	std::vector<double> areaSums((numTriangles + trianglesPerAreaTask - 1) / trianglesPerAreaTask, 0.0);
+	pool.ParallelForRange(numTriangles, trianglesPerAreaTask, [&](size_t begin, size_t end) {
+		double sum = 0;
+		for (size_t t = begin; t < end; t++) { sum += ProjectedArea(vertices, triangles[t], light); }
+		areaSums[begin / trianglesPerAreaTask] = sum;
+	});
+	double totalArea = 0;
+	for (double sum : areaSums) { totalArea += sum; }
+	double weightPerArea = totalArea > 0 ? double(vertices.size()) / totalArea / double(perTriangle) : 0;	//the lens as a whole adds up to one per vertex, the same brightness as without supersampling
+	double equalWeight = double(vertices.size()) / double(numTriangles) / double(perTriangle);	//for a lens that's flat on edge, where the areas say nothing
+
+	size_t trianglesPerBlock = std::max<size_t>(1, raysPerBlock / perTriangle);
+	size_t perPass = DistancesPerPass(numDistances, numPixels, sizeof(double));
+	for (size_t first = 0; first < numDistances; first += perPass) {	//a pass per set of distances that fits the budget, the rays come out the same every time since they're seeded per triangle
+		std::span<const double> passDistances = distances.subspan(first, std::min(perPass, numDistances - first));
+		size_t numTasks = SweepTasks(passDistances.size(), numPixels, (numTriangles + trianglesPerBlock - 1) / trianglesPerBlock, sizeof(double));
+		std::vector<std::vector<double>> partials(numTasks);
+		pool.ParallelFor(numTasks, [&](size_t task) {	//each task makes its rays a block at a time and throws them away once they're splatted
+			std::vector<double>& histograms = partials[task];
+			histograms.assign(passDistances.size() * numPixels, 0.0);
+			BasicAffineIntersections<Scalar> sampled;
+			std::vector<double> weights;
+			size_t offScreen = 0;
+			size_t begin = numTriangles * task / numTasks, end = numTriangles * (task + 1) / numTasks;
+			for (size_t block = begin; block < end; block += trianglesPerBlock) {
+				std::span<const Triangle> blockTriangles = triangles.subspan(block, std::min(end, block + trianglesPerBlock) - block);
+				PrepareSampledIntersections(vertices, normals, blockTriangles, int(perTriangle), n, light, &sampled, seed);
+				weights.resize(sampled.size());
+				for (size_t t = 0; t < blockTriangles.size(); t++) {	//a triangle's samples share out the light it catches
+					double weight = totalArea > 0 ? ProjectedArea(vertices, blockTriangles[t], light) * weightPerArea : equalWeight;
+					std::fill(weights.begin() + t * perTriangle, weights.begin() + (t + 1) * perTriangle, weight);
+				}
+				offScreen += SplatBlock(sampled, 0, sampled.size(), weights.data(), passDistances, width, height, histograms.data());
+			}
+			CountSplatted((end - begin) * perTriangle * passDistances.size(), offScreen);
+		});
+		MergePartials(partials, std::span<Irradiance>(images->data() + first, passDistances.size()));
+	}
+}
+
+void StreamingSweep(LensStream* stream, size_t raysPerBlock, double n, const Light& light, std::span<const double> distances, int width, int height, std::vector<Irradiance>* images) {
+	size_t numDistances = distances.size();
+	size_t numPixels = size_t(width) * size_t(height);
+	images->resize(numDistances);
+	for (Irradiance& image : *images) { image.Resize(width, height); }
+	if (numDistances == 0 || numPixels == 0) { return; }
+	double nearPlane = *std::min_element(distances.begin(), distances.end()), farPlane = *std::max_element(distances.begin(), distances.end());
+
+	size_t perPass = DistancesPerPass(numDistances, numPixels, sizeof(uint32_t));
+	std::vector<std::vector<uint32_t>> partials;	//kept across blocks and merged once at the end, clearing and merging them per block would cost more than the splats once there are many distances
+	if (perPass == numDistances) {
+		ScopedTimer timer(Stage::Accumulate);
+		ClearPartials(SweepTasks(numDistances, numPixels, SIZE_MAX, sizeof(uint32_t)), numDistances * numPixels, &partials);	//as many as there'd be for one big lens, a small block just leaves some tasks without rays
+	}
+	RayBuffer vertices, normals, refracteds;	//one block's worth, reused for the next
+	AffineIntersections affine, active;
+	while (ReadLensBlock(stream, raysPerBlock, &vertices, &normals) > 0) {
+		Refract(vertices, normals, &refracteds, n, light);
+		PrepareAffineIntersections(vertices, refracteds, &affine);
+		CompactIntersections(affine, nearPlane, farPlane, &active);	//the sweep only ever looks at this range
+		ScopedTimer timer(Stage::Accumulate);
+		if (perPass == numDistances) { SplatIntoPartials(active, distances, width, height, &partials); }
+		else {	//too many distances for the budget to hold all their histograms, so every block goes through them a pass at a time and is merged straight away, slower but the stream can't be read twice
+			for (size_t first = 0; first < numDistances; first += perPass) {
+				std::span<const double> passDistances = distances.subspan(first, std::min(perPass, numDistances - first));
+				ClearPartials(SweepTasks(passDistances.size(), numPixels, (active.size() + ::raysPerBlock - 1) / ::raysPerBlock, sizeof(uint32_t)), passDistances.size() * numPixels, &partials);
+				SplatIntoPartials(active, passDistances, width, height, &partials);
+				MergePartials(partials, std::span<Irradiance>(images->data() + first, passDistances.size()));
+			}
+		}
+	}
+	ScopedTimer timer(Stage::Accumulate);
+	if (perPass == numDistances) { MergePartials(partials, std::span<Irradiance>(*images)); }
+}
+
+void MeasureFocus(const Irradiance& image, SweepResult* result) {
+	size_t numPixels = image.pixels.size();
+	if (numPixels == 0) { return; }
+
+	double sum = 0, sumSquares = 0;
+	for (float value : image.pixels) {
+		sum += value;
+		sumSquares += double(value) * value;
+	}
+	double mean = sum / double(numPixels);
+	if (mean <= 0) { result->contrast = 0; result->sharpness = 0; return; }
+	double variance = std::max(0.0, sumSquares / double(numPixels) - mean * mean);
+	result->contrast = std::sqrt(variance) / mean;
+
+	double gradientEnergy = 0;	//forward differences in x and y
+	for (int y = 0; y + 1 < image.height; y++) {
+		const float* row = image.pixels.data() + size_t(y) * size_t(image.width);
+		const float* nextRow = row + image.width;
+		for (int x = 0; x + 1 < image.width; x++) {
+			double dx = double(row[x + 1]) - row[x];
+			double dy = double(nextRow[x]) - row[x];
+			gradientEnergy += dx * dx + dy * dy;
+		}
+	}
+	result->sharpness = gradientEnergy / double(numPixels) / (mean * mean);
+}
+
+std::vector<double> SweepDistances(double start, double end, int steps) {
+	std::vector<double> distances;
+	for (int i = 0; i < steps; i++) { distances.push_back(steps == 1 ? start : start + (end - start) * i / (steps - 1)); }
+	return distances;
+}
+
+template void FocusSweep(const BasicAffineIntersections<float>&, std::span<const double>, int, int, std::vector<Irradiance>*);
+template void FocusSweep(const BasicAffineIntersections<double>&, std::span<const double>, int, int, std::vector<Irradiance>*);
+template void SupersampledSweep(const BasicRayBuffer<float>&, const BasicRayBuffer<float>&, std::span<const Triangle>, int, double, const Light&, std::span<const double>, int, int, std::vector<Irradiance>*, uint64_t);
+template void SupersampledSweep(const BasicRayBuffer<double>&, const BasicRayBuffer<double>&, std::span<const Triangle>, int, double, const Light&, std::span<const double>, int, int, std::vector<Irradiance>*, uint64_t);
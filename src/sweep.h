@@ -0,0 +1,26 @@
+#pragma once
+#include <span>
+#include <vector>
+#include "irradiance.h"
+#include "raybuffer.h"
+#include "refract.h"
+
+struct SweepResult {	//image quality at one receiver distance, higher is better for both
+	double distance = 0;
+	double contrast = 0;	//standard deviation of the irradiance over its mean, a blurry caustic flattens out towards 0
+	double sharpness = 0;	//mean squared gradient over the squared mean, rewards crisp edges rather than just uneven brightness
+};
+
+template<typename Scalar>
+void FocusSweep(const BasicAffineIntersections<Scalar>& affine, std::span<const double> distances, int width, int height, std::vector<Irradiance>* images);	//splats every ray into one image per distance in a single pass over the rays
+
+template<typename Scalar>
+void SupersampledSweep(const BasicRayBuffer<Scalar>& vertices, const BasicRayBuffer<Scalar>& normals, std::span<const Triangle> triangles, int samplesPerTriangle, double n, const Light& light, std::span<const double> distances, int width, int height, std::vector<Irradiance>* images, uint64_t seed = 0);	//the same with samplesPerTriangle rays spread over each triangle instead of one per vertex, made on the fly a block at a time per task
+//each triangle's rays are weighted by its share of the lens area as seen from the light, so the images come out as bright as FocusSweep's and uneven meshes don't bias them
+
+void StreamingSweep(LensStream* stream, size_t raysPerBlock, double n, const Light& light, std::span<const double> distances, int width, int height, std::vector<Irradiance>* images);	//FocusSweep of a lens read, refracted and splatted raysPerBlock rays at a time, so memory goes with the block and image sizes instead of the lens
+//the same images as loading the whole lens, since every ray lands on its own, only the slab model needs the whole lens at once
+
+void MeasureFocus(const Irradiance& image, SweepResult* result);	//fills in contrast and sharpness
+
+std::vector<double> SweepDistances(double start, double end, int steps);	//steps evenly spaced distances from start to end inclusive
@@ -0,0 +1,82 @@
+#include "threadpool.h"
+
+#include <algorithm>
+
+static thread_local bool insideParallelFor = false;	//set on threads that are currently running tasks, so nested loops don't wait on the pool they're running on
+
+ThreadPool::ThreadPool(unsigned numThreads) {
+	if (numThreads == 0) { numThreads = 1; }	//hardware_concurrency is allowed to return 0 when it can't tell
+	for (unsigned i = 1; i < numThreads; i++) {
+		workers.emplace_back(&ThreadPool::WorkerLoop, this);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers) { worker.join(); }
+}
+
+void ThreadPool::RunTasks() {	//grabs tasks off the shared counter until there are none left
+	size_t i;
+	while ((i = nextTask.fetch_add(1, std::memory_order_relaxed)) < numTasks) {
+		(*task)(i);
+		finishedTasks.fetch_add(1, std::memory_order_release);
+	}
+}
+
+void ThreadPool::WorkerLoop() {
+	insideParallelFor = true;
+	unsigned long long seenGeneration = 0;
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		wake.wait(lock, [&] { return stop || (task != nullptr && generation != seenGeneration); });
+		if (stop) { return; }
+		seenGeneration = generation;
+		workersInJob++;
+		lock.unlock();
+		RunTasks();
+		lock.lock();
+		workersInJob--;
+		if (workersInJob == 0) { done.notify_one(); }
+	}
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& function) {
+	if (insideParallelFor || workers.empty() || count <= 1) {	//nothing to gain from waking the pool
+		for (size_t i = 0; i < count; i++) { function(i); }
+		return;
+	}
+
+	std::lock_guard<std::mutex> submitLock(submitMutex);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		task = &function;
+		numTasks = count;
+		nextTask.store(0, std::memory_order_relaxed);
+		finishedTasks.store(0, std::memory_order_relaxed);
+		generation++;
+	}
+	wake.notify_all();
+
+	insideParallelFor = true;	//the calling thread chips in instead of sitting idle
+	RunTasks();
+	insideParallelFor = false;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [&] { return finishedTasks.load(std::memory_order_acquire) == numTasks && workersInJob == 0; });	//wait for stragglers before the task goes out of scope
+	task = nullptr;
+}
+
+void ThreadPool::ParallelForRange(size_t count, size_t chunkSize, const std::function<void(size_t, size_t)>& function) {
+	size_t numChunks = (count + chunkSize - 1) / chunkSize;
+	ParallelFor(numChunks, [&](size_t i) { function(i * chunkSize, std::min(count, (i + 1) * chunkSize)); });
+}
+
+ThreadPool& GlobalThreadPool() {
+	static ThreadPool pool;
+	return pool;
+}
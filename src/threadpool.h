@@ -0,0 +1,40 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {	//fixed set of worker threads that are started once and then reused by every parallel loop
+public:
+	explicit ThreadPool(unsigned numThreads = std::thread::hardware_concurrency());	//numThreads counts the calling thread, which also does work
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	unsigned NumThreads() const { return unsigned(workers.size()) + 1; }
+
+	void ParallelFor(size_t numTasks, const std::function<void(size_t)>& task);	//runs task(0) ... task(numTasks - 1) across the pool and returns once all of them have finished, nested calls run serially on the calling thread
+	void ParallelForRange(size_t count, size_t chunkSize, const std::function<void(size_t, size_t)>& task);	//cuts [0, count) into fixed chunkSize pieces and runs task(begin, end) on each, keep chunkSize a multiple of the vector width so only the last piece has a tail
+
+private:
+	void WorkerLoop();
+	void RunTasks();
+
+	std::vector<std::thread> workers;
+	std::mutex submitMutex;			//only one parallel loop runs on the pool at a time
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	const std::function<void(size_t)>* task = nullptr;
+	size_t numTasks = 0;
+	std::atomic<size_t> nextTask{0};
+	std::atomic<size_t> finishedTasks{0};
+	unsigned workersInJob = 0;
+	unsigned long long generation = 0;
+	bool stop = false;
+};
+
+ThreadPool& GlobalThreadPool();	//the pool shared by all the stages, created the first time it is used